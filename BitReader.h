@@ -0,0 +1,149 @@
+//BitReader：从一块连续的内存里读比特流，一次补充64比特的窗口
+//
+//Costella::Bitstream::In每次用istream::get读一个字节，要处理unread，读到文件尾的时候还会抛出string异常
+//解码的时候每个比特都要经过这些处理，太慢了
+//BitReader直接从内存里一次读8个字节（不要求对齐）补充窗口，补充一次至少有56个比特可用
+//解码的时候先peek(n)窥视前面的n个比特，查表知道编码长度以后再consume(len)把用掉的比特去掉，中间没有任何检查和异常
+//读到缓冲区末尾以后用0补充，调用者要自己根据文件里记录的比特数知道什么时候停下来
+//
+//SourceBitReader的用法和BitReader一样，但是从ByteSource里一段一段地取输入补充窗口，用于管道这样没法一次读进内存的输入
+//它会往前多取一段输入，比特流后面不能再有别的内容
+
+#ifndef BIT_READER_H
+#define BIT_READER_H
+
+#include <cstring>//需要使用memcpy
+#include <cstddef>//需要使用size_t
+#include <stdint.h>//需要使用uint64_t
+#include "ByteIO.h"
+
+//SourceBitReader每次从ByteSource取的字节数
+#define SOURCE_BIT_READER_CHUNK 65536
+
+class BitReader
+{
+public:
+	//空的比特流，用来先声明变量，以后再赋值
+	BitReader()
+		:begin_(0),end_(0),ptr_(0),window_(0),used_(0)
+	{
+	}
+
+	//begin和end是存放比特流的内存，先读的比特在字节的高位
+	BitReader(const unsigned char *begin,const unsigned char *end)
+		:begin_(begin),end_(end),ptr_(begin),window_(0),used_(0)
+	{
+		refill();
+	}
+
+	//补充窗口，补充以后至少有57个比特可以窥视
+	void refill(){
+		ptr_+=used_>>3;//用掉的整字节跳过去
+		used_&=7;
+		if(end_-ptr_>=8){//后面至少还有8个字节，一次读进来
+			uint64_t value;
+			memcpy(&value,ptr_,8);
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+			value=__builtin_bswap64(value);
+#else
+			const unsigned char *p=reinterpret_cast<const unsigned char*>(&value);
+			value=0;
+			for(int i=0;i<8;++i){
+				value=(value<<8)|p[i];
+			}
+#endif
+			window_=value<<used_;
+		}else{//快到末尾了，剩下的字节一个一个读进来，后面补0
+			uint64_t value=0;
+			for(int i=0;i<8;++i){
+				value<<=8;
+				if(ptr_+i<end_){
+					value|=ptr_[i];
+				}
+			}
+			window_=value<<used_;
+		}
+	}
+
+	//窥视前面的n个比特，n不能超过available()
+	uint64_t peek(int n) const{
+		return window_>>(64-n);
+	}
+
+	//去掉前面的n个比特，n不能超过available()
+	void consume(int n){
+		window_<<=n;
+		used_+=n;
+	}
+
+	//窗口里还能窥视的比特数，不够的时候调用refill
+	int available() const{
+		return 64-used_;
+	}
+
+	//一共读了多少比特
+	uint64_t position() const{
+		return (ptr_-begin_)*8+used_;
+	}
+
+private:
+	const unsigned char *begin_;
+	const unsigned char *end_;
+	const unsigned char *ptr_;//窗口的第一个字节
+	uint64_t window_;//窗口，最高位是下一个要读的比特
+	int used_;//从ptr_开始已经用掉的比特数
+};
+
+class SourceBitReader
+{
+public:
+	SourceBitReader(ByteSource &in)
+		:in_(in),ptr_(0),end_(0),done_(false),window_(0),bits_(0),position_(0)
+	{
+		refill();
+	}
+
+	//补充窗口，补充以后至少有57个比特可以窥视，输入读完以后用0补充
+	void refill(){
+		while(bits_<=56){
+			if(ptr_==end_ && !done_){//这一段用完了，再取一段
+				size_t n=0;
+				ptr_=in_.next(SOURCE_BIT_READER_CHUNK,n);
+				end_=ptr_+n;
+				done_=(n==0);
+			}
+			unsigned char c=(ptr_!=end_ ? *ptr_++ : 0);
+			window_|=static_cast<uint64_t>(c)<<(56-bits_);
+			bits_+=8;
+		}
+	}
+
+	uint64_t peek(int n) const{
+		return window_>>(64-n);
+	}
+
+	void consume(int n){
+		window_<<=n;
+		bits_-=n;
+		position_+=n;
+	}
+
+	int available() const{
+		return bits_;
+	}
+
+	uint64_t position() const{
+		return position_;
+	}
+
+private:
+	ByteSource &in_;
+	const unsigned char *ptr_;//当前这段输入里下一个要读的字节
+	const unsigned char *end_;
+	bool done_;//输入已经读完了
+	uint64_t window_;//窗口，最高位是下一个要读的比特
+	int bits_;//窗口里的有效比特数
+	uint64_t position_;//一共读了多少比特
+};
+
+#endif
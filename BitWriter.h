@@ -0,0 +1,105 @@
+//BitWriter：用64比特的寄存器攒比特的比特流输出
+//
+//Costella::Bitstream::Out每次只能写1到8个比特，每写一个比特都要检查位置是否溢出，攒满一个字节就调用一次ostream::put
+//huffman编码的时候每个单词都要写一个变长的编码，用它就太慢了
+//BitWriter一次写入整个编码（编码的比特和长度），攒满64比特以后一次往缓冲区里存8个字节
+//缓冲区由调用者提供，调用者负责在缓冲区快满的时候把里面的内容写到文件里去
+//写出来的比特顺序和Costella::Bitstream::Out一样，先写的比特在字节的高位，最后不满一个字节的部分用0补齐
+
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+
+#include <cstring>//需要使用memcpy
+#include <cstddef>//需要使用size_t
+#include <stdint.h>//需要使用uint64_t
+
+class BitWriter
+{
+public:
+	//begin和end是调用者提供的缓冲区
+	BitWriter(unsigned char *begin,unsigned char *end)
+		:begin_(begin),end_(end),ptr_(begin),acc_(0),acc_bits_(0),position_(0)
+	{
+	}
+
+	//从begin第一个字节的第skip_bits个比特（0到7，从高位数）开始写，前面的比特写成0，调用者要自己把原来的比特OR回去
+	//用于几个线程把各自的编码直接写到同一个比特流里事先算好的位置上，position()不算跳过的比特
+	BitWriter(unsigned char *begin,unsigned char *end,int skip_bits)
+		:begin_(begin),end_(end),ptr_(begin),acc_(0),acc_bits_(skip_bits),position_(0)
+	{
+	}
+
+	//写一个编码，code的低len位是编码，高位必须是0，len可以是0到64
+	//写之前缓冲区里至少要有8个字节的空间
+	void put(uint64_t code,int len){
+		position_+=len;
+		int free_bits=64-acc_bits_;//寄存器里还空着的比特数，总是大于0
+		if(len<free_bits){
+			acc_|=code<<(free_bits-len);
+			acc_bits_+=len;
+		}else{//寄存器放不下了，先把能放下的部分放进去，存8个字节，剩下的部分放到新的寄存器里
+			int rest=len-free_bits;
+			acc_|=code>>rest;
+			store(acc_);
+			acc_=(rest==0 ? 0 : code<<(64-rest));
+			acc_bits_=rest;
+		}
+	}
+
+	//把寄存器里剩下的比特写到缓冲区里，最后不满一个字节的部分用0补齐，需要缓冲区里还有8个字节的空间
+	void flush(){
+		int bytes=(acc_bits_+7)/8;
+		for(int i=0;i<bytes;++i){
+			*ptr_++=static_cast<unsigned char>(acc_>>(56-8*i));
+		}
+		position_+=bytes*8-acc_bits_;//和Costella::Bitstream::Out一样，补齐的比特也算在位置里
+		acc_=0;
+		acc_bits_=0;
+	}
+
+	//缓冲区里已经存好的字节
+	const unsigned char *data() const{
+		return begin_;
+	}
+	size_t size() const{
+		return ptr_-begin_;
+	}
+
+	//缓冲区里还剩多少字节的空间
+	size_t room() const{
+		return end_-ptr_;
+	}
+
+	//调用者把缓冲区里的内容写走以后，调用这个函数从缓冲区开头重新存
+	void clear(){
+		ptr_=begin_;
+	}
+
+	//一共写了多少比特
+	uint64_t position() const{
+		return position_;
+	}
+
+private:
+	//按大端字节序存8个字节，先写的比特在前面
+	void store(uint64_t value){
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+		value=__builtin_bswap64(value);
+		memcpy(ptr_,&value,8);
+#else
+		for(int i=0;i<8;++i){
+			ptr_[i]=static_cast<unsigned char>(value>>(56-8*i));
+		}
+#endif
+		ptr_+=8;
+	}
+
+	unsigned char *begin_;
+	unsigned char *end_;
+	unsigned char *ptr_;//下一个字节存放的位置
+	uint64_t acc_;//还没存到缓冲区的比特，从最高位开始放
+	int acc_bits_;//acc_里的比特数，总是小于64
+	uint64_t position_;//一共写了多少比特
+};
+
+#endif
@@ -0,0 +1,245 @@
+//ByteIO：编码和解码的内核读写字节用的输入源ByteSource和输出ByteSink
+//
+//原来的内核直接调用istream::read和ostream::write，只能读写文件流，要把编解码嵌到别的程序里就得先包一层iostream
+//ByteSource每次给出一段连续的输入，内核直接在这段内存上编码；ByteSink每次接收一段连续的输出
+//ByteSource::next默认把输入读到自己的大缓冲区里，缓冲区一直重复使用，不会每次都分配；一块内存做输入的时候直接返回那块内存，不复制
+//
+//几种后端：
+//  FdSource、FdSink：文件描述符，0和1就是标准输入和标准输出，可以是管道
+//  MemorySource：一块内存，比如映射到内存里的文件
+//  MemorySink：一块固定大小的内存，写满以后再写就失败
+//  StreamSource、StreamSink：istream和ostream，给还要用文件流的地方用
+
+#ifndef BYTE_IO_H
+#define BYTE_IO_H
+
+#include <iostream>//需要使用istream、ostream
+#include <vector>//需要使用向量
+#include <cstring>//需要使用memcpy
+#include <cstddef>//需要使用size_t
+#include <cerrno>//需要使用errno
+#include <unistd.h>//需要使用read、write
+
+class ByteSource
+{
+public:
+	ByteSource()
+		:failed_(false)
+	{
+	}
+
+	virtual ~ByteSource(){
+	}
+
+	//返回下一段连续的输入，最多max个字节，n是实际的字节数
+	//没读到末尾的时候n总是max，所以调用者按max切出来的段和输入分几次读进来没有关系
+	//n是0表示读完了，读出错的时候n也是0，failed()是true；返回的内存到下一次调用next之前都有效
+	virtual const unsigned char *next(size_t max,size_t &n){
+		if(buffer_.size()<max){
+			buffer_.resize(max);
+		}
+		n=read(buffer_.empty() ? 0 : &buffer_[0],max);
+		return buffer_.empty() ? 0 : &buffer_[0];
+	}
+
+	//读最多size个字节到buf里，没读到末尾的时候总是读满size个字节，返回读到的字节数
+	size_t read(unsigned char *buf,size_t size){
+		size_t n=0;
+		while(n<size){
+			size_t got=fill(buf+n,size-n);
+			if(got==0){
+				break;
+			}
+			n+=got;
+		}
+		return n;
+	}
+
+	//读输入的时候是否出错了
+	bool failed() const{
+		return failed_;
+	}
+
+protected:
+	//读最多size个字节到buf里，返回读到的字节数，读到末尾或者出错的时候返回0，出错的时候要把failed_设成true
+	virtual size_t fill(unsigned char *buf,size_t size)=0;
+
+	bool failed_;
+
+private:
+	ByteSource(const ByteSource &);
+	ByteSource &operator=(const ByteSource &);
+
+	std::vector<unsigned char> buffer_;//next返回的缓冲区，一直重复使用
+};
+
+class ByteSink
+{
+public:
+	virtual ~ByteSink(){
+	}
+
+	//写出data开始的n个字节，失败返回false
+	virtual bool write(const unsigned char *data,size_t n)=0;
+};
+
+//从文件描述符读，read被信号打断的时候重试
+class FdSource : public ByteSource
+{
+public:
+	explicit FdSource(int fd)
+		:fd_(fd)
+	{
+	}
+
+protected:
+	virtual size_t fill(unsigned char *buf,size_t size){
+		for(;;){
+			ssize_t n=::read(fd_,buf,size);
+			if(n>=0){
+				return n;
+			}
+			if(errno!=EINTR){
+				failed_=true;
+				return 0;
+			}
+		}
+	}
+
+private:
+	int fd_;
+};
+
+//写到文件描述符，write只写了一部分或者被信号打断的时候接着写
+class FdSink : public ByteSink
+{
+public:
+	explicit FdSink(int fd)
+		:fd_(fd)
+	{
+	}
+
+	virtual bool write(const unsigned char *data,size_t n){
+		while(n>0){
+			ssize_t written=::write(fd_,data,n);
+			if(written<0 && errno==EINTR){
+				continue;
+			}
+			if(written<=0){
+				return false;
+			}
+			data+=written;
+			n-=written;
+		}
+		return true;
+	}
+
+private:
+	int fd_;
+};
+
+//从一块内存读，next直接返回这块内存里的位置
+class MemorySource : public ByteSource
+{
+public:
+	MemorySource(const unsigned char *data,size_t size)
+		:data_(data),size_(size),pos_(0)
+	{
+	}
+
+	virtual const unsigned char *next(size_t max,size_t &n){
+		n=(size_-pos_<max ? size_-pos_ : max);
+		const unsigned char *p=data_+pos_;
+		pos_+=n;
+		return p;
+	}
+
+protected:
+	virtual size_t fill(unsigned char *buf,size_t size){
+		size_t n=0;
+		const unsigned char *p=next(size,n);
+		if(n>0){
+			memcpy(buf,p,n);
+		}
+		return n;
+	}
+
+private:
+	const unsigned char *data_;
+	size_t size_;
+	size_t pos_;//下一段开始的位置
+};
+
+//写到一块固定大小的内存里，写满以后再写就失败
+class MemorySink : public ByteSink
+{
+public:
+	MemorySink(unsigned char *begin,size_t size)
+		:begin_(begin),size_(size),written_(0)
+	{
+	}
+
+	virtual bool write(const unsigned char *data,size_t n){
+		if(n>size_-written_){
+			return false;
+		}
+		if(n>0){
+			memcpy(begin_+written_,data,n);
+		}
+		written_+=n;
+		return true;
+	}
+
+	//已经写了多少字节
+	size_t written() const{
+		return written_;
+	}
+
+private:
+	unsigned char *begin_;
+	size_t size_;
+	size_t written_;
+};
+
+//从istream读，用于还要用文件流的地方
+class StreamSource : public ByteSource
+{
+public:
+	explicit StreamSource(std::istream &in)
+		:in_(in)
+	{
+	}
+
+protected:
+	virtual size_t fill(unsigned char *buf,size_t size){
+		in_.read(reinterpret_cast<char*>(buf),size);
+		if(in_.bad()){
+			failed_=true;
+			return 0;
+		}
+		return in_.gcount();
+	}
+
+private:
+	std::istream &in_;
+};
+
+//写到ostream
+class StreamSink : public ByteSink
+{
+public:
+	explicit StreamSink(std::ostream &out)
+		:out_(out)
+	{
+	}
+
+	virtual bool write(const unsigned char *data,size_t n){
+		out_.write(reinterpret_cast<const char*>(data),n);
+		return !out_.fail();
+	}
+
+private:
+	std::ostream &out_;
+};
+
+#endif
@@ -0,0 +1,148 @@
+//Histogram：统计一块内存里每个字节出现的次数
+//
+//只用一张256项的计数表的时候，连续几个相同的字节要连着给同一个计数加1，每次都要等上一次加完存回内存才能再读出来（存储转发）
+//日志和tags这样有大段空格、制表符的文件，这个等待就成了最慢的地方
+//这里用几张交错的32位计数表，相邻的字节加到不同的表里，连续相同的字节也不会互相等待，最后再把几张表加到一起
+//AVX2版本每次读32个字节，加到8张表里；SSE2版本每次读16个字节，普通版本每次读8个字节，都加到4张表里
+//向量寄存器里的字节还是要一个一个取出来加，因为没有能把计数分散加到内存里的向量指令
+//运行时检查CPU支持哪种指令，不管用哪个版本，统计的结果都和一个字节一个字节地数完全一样
+//不是x86或者编译器不是GCC的时候只有普通版本
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstring>//需要使用memcpy、memset
+#include <cstddef>//需要使用size_t
+#include <stdint.h>//需要使用uint32_t、uint64_t
+
+//最多用几张计数表
+#define HISTOGRAM_TABLES 8
+
+//每统计这么多字节就把32位的计数加到结果里，计数不会溢出
+#define HISTOGRAM_FLUSH_SIZE (1UL<<30)
+
+//统计用的版本
+#define HISTOGRAM_KERNEL_AUTO 0//根据CPU自动选择
+#define HISTOGRAM_KERNEL_SCALAR 1//每次8个字节，4张表
+#define HISTOGRAM_KERNEL_SSE2 2//每次16个字节，4张表
+#define HISTOGRAM_KERNEL_AVX2 3//每次32个字节，8张表
+
+#if defined(__GNUC__) && defined(__x86_64__)//_mm_cvtsi128_si64和_mm_extract_epi64只有64位才有，32位用普通的版本
+#define HISTOGRAM_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef uint32_t HistogramTables[HISTOGRAM_TABLES][256];
+
+//把一个64比特整数里的8个字节分别加到第first张开始的4张表里
+inline void histogram_add_word(HistogramTables tables,int first,uint64_t w){
+	++tables[first][w&0xff];
+	++tables[first+1][(w>>8)&0xff];
+	++tables[first+2][(w>>16)&0xff];
+	++tables[first+3][(w>>24)&0xff];
+	++tables[first][(w>>32)&0xff];
+	++tables[first+1][(w>>40)&0xff];
+	++tables[first+2][(w>>48)&0xff];
+	++tables[first+3][w>>56];
+}
+
+//每次8个字节，返回统计了多少字节，剩下不满8个的由调用者自己数
+inline size_t histogram_count_scalar(const unsigned char *data,size_t n,HistogramTables tables){
+	size_t i=0;
+	for(;i+8<=n;i+=8){
+		uint64_t w;
+		memcpy(&w,data+i,8);
+		histogram_add_word(tables,0,w);
+	}
+	return i;
+}
+
+#ifdef HISTOGRAM_SIMD
+
+//每次16个字节，返回统计了多少字节
+__attribute__((target("sse2")))
+inline size_t histogram_count_sse2(const unsigned char *data,size_t n,HistogramTables tables){
+	size_t i=0;
+	for(;i+16<=n;i+=16){
+		__m128i v=_mm_loadu_si128(reinterpret_cast<const __m128i*>(data+i));
+		histogram_add_word(tables,0,static_cast<uint64_t>(_mm_cvtsi128_si64(v)));
+		histogram_add_word(tables,0,static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(v,v))));
+	}
+	return i;
+}
+
+//每次32个字节，前16个字节加到前4张表里，后16个字节加到后4张表里，返回统计了多少字节
+__attribute__((target("avx2")))
+inline size_t histogram_count_avx2(const unsigned char *data,size_t n,HistogramTables tables){
+	size_t i=0;
+	for(;i+32<=n;i+=32){
+		__m256i v=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data+i));
+		__m128i low=_mm256_castsi256_si128(v), high=_mm256_extracti128_si256(v,1);
+		histogram_add_word(tables,0,static_cast<uint64_t>(_mm_cvtsi128_si64(low)));
+		histogram_add_word(tables,4,static_cast<uint64_t>(_mm_cvtsi128_si64(high)));
+		histogram_add_word(tables,0,static_cast<uint64_t>(_mm_extract_epi64(low,1)));
+		histogram_add_word(tables,4,static_cast<uint64_t>(_mm_extract_epi64(high,1)));
+	}
+	return i;
+}
+
+//这台机器上最快的版本
+inline int histogram_best_kernel(){
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		return HISTOGRAM_KERNEL_AVX2;
+	}
+	if(__builtin_cpu_supports("sse2")){
+		return HISTOGRAM_KERNEL_SSE2;
+	}
+	return HISTOGRAM_KERNEL_SCALAR;
+}
+
+#else
+
+inline int histogram_best_kernel(){
+	return HISTOGRAM_KERNEL_SCALAR;
+}
+
+#endif
+
+//这个版本在这台机器上能不能用
+inline bool histogram_kernel_supported(int kernel){
+	return kernel>=HISTOGRAM_KERNEL_SCALAR && kernel<=histogram_best_kernel();
+}
+
+//用kernel指定的版本统计data里的n个字节，加到counts里（不会先清零）
+//kernel是HISTOGRAM_KERNEL_AUTO或者这台机器不支持的版本时，用这台机器上最快的版本
+inline void histogram_count(const unsigned char *data,size_t n,long counts[256],int kernel=HISTOGRAM_KERNEL_AUTO){
+	if(kernel==HISTOGRAM_KERNEL_AUTO || !histogram_kernel_supported(kernel)){
+		kernel=histogram_best_kernel();
+	}
+	HistogramTables tables;
+	while(n>0){
+		size_t size=(n<HISTOGRAM_FLUSH_SIZE ? n : HISTOGRAM_FLUSH_SIZE);
+		memset(tables,0,sizeof(tables));
+		size_t i=0;
+#ifdef HISTOGRAM_SIMD
+		if(kernel==HISTOGRAM_KERNEL_AVX2){
+			i=histogram_count_avx2(data,size,tables);
+		}else if(kernel==HISTOGRAM_KERNEL_SSE2){
+			i=histogram_count_sse2(data,size,tables);
+		}
+#endif
+		i+=histogram_count_scalar(data+i,size-i,tables);
+		for(;i<size;++i){//最后不满8个的字节
+			++tables[0][data[i]];
+		}
+		for(int b=0;b<256;++b){
+			long sum=0;
+			for(int t=0;t<HISTOGRAM_TABLES;++t){
+				sum+=tables[t][b];
+			}
+			counts[b]+=sum;
+		}
+		data+=size;
+		n-=size;
+	}
+}
+
+#endif
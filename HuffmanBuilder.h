@@ -0,0 +1,46 @@
+//HuffmanBuilder：先把叶子按权重排好序，再用两个队列在线性时间内合并出huffman树
+//
+//原来每次合并都要扫描一遍所有的根找最小的两个，n个单词要合并n-1次，一共是O(n^2)；优先队列是O(n log n)，每次比较还要顺着指针取权重
+//单词只有256个的时候差别不大，单词多了（比如按两个字节或者按词做单词，有几万到上百万个）就慢得多
+//合并出来的中间节点的权重是从小到大的（后合并的两个根都不比先合并的小），所以中间节点按合并的顺序排成一个队列就是有序的
+//叶子事先排好序是另一个有序的队列，每次只要比较两个队列的队头，就能找到最小的根，排序以后合并只要O(n)
+//两个队头的权重一样的时候先取叶子，这样合并出来的树最矮
+//
+//树的节点要有lchild、rchild、parent、weight四个成员，和两个huffman_zip里的HuffmanNode一样：
+//前n个是叶子，权重已经填好，后面n-1个节点放合并出来的中间节点，最后一个是根，下标都是-1表示没有
+
+#ifndef HUFFMAN_BUILDER_H
+#define HUFFMAN_BUILDER_H
+
+#include <vector>//需要使用向量
+#include <utility>//需要使用pair
+#include <algorithm>//需要使用sort
+
+//ht有2*n-1个节点，前n个叶子的权重已经填好，把后面的n-1个节点合并成huffman树，每次合并权重最小的两个根，先取的做左孩子
+template<class Tree>
+void two_queue_huffman_tree(Tree &ht,long n){
+	std::vector<std::pair<long,long> > leaves(n);//叶子按权重排序，权重一样的按下标，结果和叶子的顺序无关
+	for(long i=0;i<n;++i){
+		leaves[i].first=ht[i].weight;
+		leaves[i].second=i;
+	}
+	std::sort(leaves.begin(),leaves.end());
+	long leaf=0;//叶子队列的队头
+	long inner=n;//中间节点队列的队头，队尾就是下一个要合并出来的节点
+	for(long i=n;i<2*n-1;++i){
+		long pos[2];
+		for(int k=0;k<2;++k){//从两个队头里取权重小的，一样的时候先取叶子
+			if(leaf<n && (inner==i || leaves[leaf].first<=ht[inner].weight)){
+				pos[k]=leaves[leaf++].second;
+			}else{
+				pos[k]=inner++;
+			}
+		}
+		ht[pos[0]].parent=ht[pos[1]].parent=i;
+		ht[i].lchild=pos[0];
+		ht[i].rchild=pos[1];
+		ht[i].weight=ht[pos[0]].weight+ht[pos[1]].weight;
+	}
+}
+
+#endif
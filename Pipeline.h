@@ -0,0 +1,428 @@
+//Pipeline：读、编解码、写三个阶段的流水线
+//
+//原来读输入、编码（或解码）、写输出在一个线程里一个接一个地做，读磁盘的时候CPU闲着，编码的时候磁盘闲着
+//这里读和写各用一个线程：ThreadedSource在读线程里从原来的ByteSource读，ThreadedSink在写线程里往原来的ByteSink写，
+//编解码还在调用者的线程里，用起来和别的ByteSource、ByteSink一样
+//
+//阶段之间用PipelineChannel传缓冲区：缓冲区事先分配好固定的几个，满的缓冲区从上一阶段传给下一阶段，用完的再传回去重复使用，
+//运行的时候不再分配内存；两个方向各是一个SpscRing，只有一个线程往里放、一个线程往外取，不用锁，只用原子的读写
+//缓冲区都在用的时候（或者没有满的缓冲区的时候）先让出CPU几次，还等不到就睡一小会儿，等的时间记下来，-v的时候输出每个阶段等了多久
+//
+//任何一边出错的时候调用cancel，另一边等缓冲区的时候会立刻返回失败，不会一直等下去
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>//需要使用向量
+#include <cstring>//需要使用memcpy
+#include <cstddef>//需要使用size_t
+#include <pthread.h>
+#include <sched.h>//需要使用sched_yield
+#include <time.h>//需要使用clock_gettime、nanosleep
+#include "ByteIO.h"
+
+//流水线每个方向的缓冲区个数和每个缓冲区的字节数
+#define PIPELINE_BUFFERS 8
+#define PIPELINE_BUFFER_SIZE (1L<<20)
+
+//等缓冲区的时候先让出CPU这么多次，再改成每次睡PIPELINE_SLEEP_NS纳秒
+#define PIPELINE_SPINS 64
+#define PIPELINE_SLEEP_NS 20000
+
+//每个阶段等了多少秒
+struct PipelineStats{
+	double read_wait;//读线程等空的输入缓冲区，也就是编解码跟不上读
+	double input_wait;//编解码等输入
+	double output_wait;//编解码等空的输出缓冲区，也就是写跟不上编解码
+	double write_wait;//写线程等输出
+};
+
+inline double pipeline_now(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+//只有一个线程放、一个线程取的环形队列，容量是2的幂
+template<typename T>
+class SpscRing
+{
+public:
+	explicit SpscRing(size_t capacity)
+		:head_(0),tail_(0)
+	{
+		size_t size=1;
+		while(size<capacity){
+			size<<=1;
+		}
+		slots_.resize(size);
+		mask_=size-1;
+	}
+
+	//放一个元素，满了返回false，只能由放的线程调用
+	bool push(const T &value){
+		size_t tail=tail_;
+		if(tail-__atomic_load_n(&head_,__ATOMIC_ACQUIRE)==slots_.size()){
+			return false;
+		}
+		slots_[tail&mask_]=value;
+		__atomic_store_n(&tail_,tail+1,__ATOMIC_RELEASE);//元素放好以后才让取的线程看到
+		return true;
+	}
+
+	//取一个元素，空的时候返回false，只能由取的线程调用
+	bool pop(T &value){
+		size_t head=head_;
+		if(head==__atomic_load_n(&tail_,__ATOMIC_ACQUIRE)){
+			return false;
+		}
+		value=slots_[head&mask_];
+		__atomic_store_n(&head_,head+1,__ATOMIC_RELEASE);//元素取走以后才让放的线程覆盖这个位置
+		return true;
+	}
+
+private:
+	std::vector<T> slots_;
+	size_t mask_;
+	//放的线程和取的线程各改一个位置，分开放在不同的缓存行里，免得来回抢同一个缓存行
+	char pad0_[64];
+	size_t head_;//下一个要取的位置，只有取的线程改
+	char pad1_[64];
+	size_t tail_;//下一个要放的位置，只有放的线程改
+	char pad2_[64];
+};
+
+//流水线里传的缓冲区
+struct PipelineBuffer{
+	std::vector<unsigned char> data;
+	size_t size;//data里有效的字节数
+};
+
+//一个生产者阶段和一个消费者阶段之间的通道，满的缓冲区从full_传过去，用完的从free_传回来
+class PipelineChannel
+{
+public:
+	PipelineChannel(size_t buffers,size_t buffer_size)
+		:pool_(buffers),full_(buffers),free_(buffers),closed_(0),cancelled_(0),producer_wait_(0),consumer_wait_(0)
+	{
+		for(size_t i=0;i<buffers;++i){
+			pool_[i].data.resize(buffer_size);
+			pool_[i].size=0;
+			free_.push(&pool_[i]);
+		}
+	}
+
+	//生产者：取一个空的缓冲区，都在用的时候等着，取消了返回0
+	PipelineBuffer *acquire(){
+		PipelineBuffer *buf=0;
+		if(free_.pop(buf)){
+			return buf;
+		}
+		double start=pipeline_now();
+		int spins=0;
+		while(!free_.pop(buf)){
+			if(cancelled()){
+				buf=0;
+				break;
+			}
+			backoff(spins);
+		}
+		producer_wait_+=pipeline_now()-start;
+		return buf;
+	}
+
+	//生产者：把装好的缓冲区传给消费者，缓冲区一共就这么多，full_一定放得下
+	void send(PipelineBuffer *buf){
+		full_.push(buf);
+	}
+
+	//生产者：不会再有缓冲区了
+	void close(){
+		__atomic_store_n(&closed_,1,__ATOMIC_RELEASE);
+	}
+
+	//消费者：取一个装好的缓冲区，没有的时候等着，生产者关闭了并且都取完了或者取消了返回0
+	PipelineBuffer *receive(){
+		PipelineBuffer *buf=0;
+		if(full_.pop(buf)){
+			return buf;
+		}
+		double start=pipeline_now();
+		int spins=0;
+		for(;;){
+			if(full_.pop(buf)){
+				break;
+			}
+			if(__atomic_load_n(&closed_,__ATOMIC_ACQUIRE)){//关闭之前放的缓冲区一定能看到，再取一次
+				if(!full_.pop(buf)){
+					buf=0;
+				}
+				break;
+			}
+			if(cancelled()){
+				buf=0;
+				break;
+			}
+			backoff(spins);
+		}
+		consumer_wait_+=pipeline_now()-start;
+		return buf;
+	}
+
+	//消费者：用完的缓冲区还给生产者
+	void release(PipelineBuffer *buf){
+		free_.push(buf);
+	}
+
+	//任何一边出错的时候调用，另一边不要再等了
+	void cancel(){
+		__atomic_store_n(&cancelled_,1,__ATOMIC_RELEASE);
+	}
+
+	bool cancelled() const{
+		return __atomic_load_n(&cancelled_,__ATOMIC_ACQUIRE)!=0;
+	}
+
+	//生产者和消费者各等了多少秒
+	double producer_wait() const{
+		return producer_wait_;
+	}
+	double consumer_wait() const{
+		return consumer_wait_;
+	}
+
+private:
+	PipelineChannel(const PipelineChannel &);
+	PipelineChannel &operator=(const PipelineChannel &);
+
+	static void backoff(int &spins){
+		if(spins<PIPELINE_SPINS){
+			++spins;
+			sched_yield();
+		}else{
+			timespec ts={0,PIPELINE_SLEEP_NS};
+			nanosleep(&ts,0);
+		}
+	}
+
+	std::vector<PipelineBuffer> pool_;
+	SpscRing<PipelineBuffer*> full_;//生产者到消费者
+	SpscRing<PipelineBuffer*> free_;//消费者还回来的
+	int closed_;
+	int cancelled_;
+	double producer_wait_;//只有生产者改
+	double consumer_wait_;//只有消费者改
+};
+
+//在读线程里从source读，调用者用next或者read取，返回的内存就是流水线的缓冲区，不复制
+//next要的字节数不超过一个缓冲区里剩下的字节数的时候不复制，否则退回到ByteSource::next拼起来
+class ThreadedSource : public ByteSource
+{
+public:
+	ThreadedSource(ByteSource &source,size_t buffers,size_t buffer_size)
+		:source_(source),channel_(buffers,buffer_size),current_(0),pos_(0),done_(false),started_(false),joined_(false)
+	{
+		started_=(pthread_create(&thread_,0,reader_main,this)==0);
+		if(started_==false){//创建不了线程就在调用者的线程里直接读
+			channel_.cancel();
+		}
+	}
+
+	~ThreadedSource(){
+		stop();
+	}
+
+	//不再取了，让读线程停下来并等它结束，以后才能看read_wait
+	void stop(){
+		if(started_ && !joined_){
+			channel_.cancel();
+			pthread_join(thread_,0);
+			joined_=true;
+		}
+	}
+
+	virtual const unsigned char *next(size_t max,size_t &n){
+		if(started_ && current()){
+			size_t rest=current_->size-pos_;
+			if(rest>=max || current_->size<current_->data.size()){//这个缓冲区里够了，或者这是最后一个缓冲区
+				n=(rest<max ? rest : max);
+				const unsigned char *p=&current_->data[0]+pos_;
+				pos_+=n;
+				return p;
+			}
+		}
+		return ByteSource::next(max,n);
+	}
+
+	//读线程等了多少秒，调用者等输入等了多少秒
+	double read_wait() const{
+		return channel_.producer_wait();
+	}
+	double input_wait() const{
+		return channel_.consumer_wait();
+	}
+
+protected:
+	virtual size_t fill(unsigned char *buf,size_t size){
+		if(started_==false){
+			size_t n=source_.read(buf,size);
+			failed_=source_.failed();
+			return n;
+		}
+		if(!current()){
+			return 0;
+		}
+		size_t n=current_->size-pos_;
+		if(n>size){
+			n=size;
+		}
+		memcpy(buf,&current_->data[0]+pos_,n);
+		pos_+=n;
+		return n;
+	}
+
+private:
+	//保证current_里还有没取的字节，用完的缓冲区还给读线程，读完了返回false
+	bool current(){
+		if(current_!=0 && pos_<current_->size){
+			return true;
+		}
+		if(current_!=0){
+			channel_.release(current_);
+			current_=0;
+		}
+		if(done_){
+			return false;
+		}
+		current_=channel_.receive();
+		pos_=0;
+		if(current_==0 || current_->size==0){
+			done_=true;
+			failed_=source_.failed();//读线程关闭通道以前设好了，receive返回0以后一定能看到
+			return false;
+		}
+		return true;
+	}
+
+	static void *reader_main(void *p){
+		ThreadedSource *self=static_cast<ThreadedSource*>(p);
+		PipelineChannel &channel=self->channel_;
+		for(;;){
+			PipelineBuffer *buf=channel.acquire();
+			if(buf==0){
+				break;
+			}
+			buf->size=self->source_.read(&buf->data[0],buf->data.size());
+			channel.send(buf);
+			if(buf->size<buf->data.size()){//读到末尾了
+				break;
+			}
+		}
+		channel.close();
+		return 0;
+	}
+
+	ByteSource &source_;
+	PipelineChannel channel_;
+	PipelineBuffer *current_;//调用者正在取的缓冲区
+	size_t pos_;//current_里下一个要取的字节
+	bool done_;
+	bool started_;
+	bool joined_;//读线程已经结束了
+	pthread_t thread_;
+};
+
+//调用者写的内容先攒到流水线的缓冲区里，攒满一个就交给写线程往sink里写
+//写完以后要调用finish，等写线程把所有的内容写完，它返回false说明写失败了
+class ThreadedSink : public ByteSink
+{
+public:
+	ThreadedSink(ByteSink &sink,size_t buffers,size_t buffer_size)
+		:sink_(sink),channel_(buffers,buffer_size),current_(0),failed_(false),started_(false)
+	{
+		started_=(pthread_create(&thread_,0,writer_main,this)==0);
+	}
+
+	~ThreadedSink(){
+		if(started_){
+			channel_.cancel();
+			pthread_join(thread_,0);
+		}
+	}
+
+	virtual bool write(const unsigned char *data,size_t n){
+		if(started_==false){//创建不了线程就在调用者的线程里直接写
+			return sink_.write(data,n);
+		}
+		while(n>0){
+			if(current_==0){
+				current_=channel_.acquire();
+				if(current_==0){//写线程出错了
+					return false;
+				}
+				current_->size=0;
+			}
+			size_t room=current_->data.size()-current_->size;
+			size_t len=(n<room ? n : room);
+			memcpy(&current_->data[0]+current_->size,data,len);
+			current_->size+=len;
+			data+=len;
+			n-=len;
+			if(current_->size==current_->data.size()){
+				channel_.send(current_);
+				current_=0;
+			}
+		}
+		return true;
+	}
+
+	//把没攒满的缓冲区也交给写线程，等它写完
+	bool finish(){
+		if(started_==false){
+			return true;
+		}
+		if(current_!=0){
+			channel_.send(current_);//没写东西的缓冲区也这样还回去，写线程写0个字节
+			current_=0;
+		}
+		channel_.close();
+		pthread_join(thread_,0);
+		started_=false;
+		return failed_==false;
+	}
+
+	//调用者等空的缓冲区等了多少秒，写线程等了多少秒
+	double output_wait() const{
+		return channel_.producer_wait();
+	}
+	double write_wait() const{
+		return channel_.consumer_wait();
+	}
+
+private:
+	static void *writer_main(void *p){
+		ThreadedSink *self=static_cast<ThreadedSink*>(p);
+		PipelineChannel &channel=self->channel_;
+		for(;;){
+			PipelineBuffer *buf=channel.receive();
+			if(buf==0){
+				break;
+			}
+			if(self->failed_==false && self->sink_.write(&buf->data[0],buf->size)==false){
+				self->failed_=true;
+				channel.cancel();
+			}
+			channel.release(buf);
+		}
+		return 0;
+	}
+
+	ByteSink &sink_;
+	PipelineChannel channel_;
+	PipelineBuffer *current_;//调用者正在攒的缓冲区
+	bool failed_;//写线程写失败了，finish里join以后再看
+	bool started_;
+	pthread_t thread_;
+};
+
+#endif
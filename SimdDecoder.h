@@ -0,0 +1,88 @@
+//SimdDecoder：用AVX2指令同时解码8个交错的子比特流
+//
+//第3版格式把单词轮流放到几个子比特流里，第i个单词在第i%子流数个子流里，每个子流都可以从头单独解码
+//8个子流的时候，AVX2的8个32位通道每个负责一个子流，每一轮每个通道解一个单词，8个单词正好是输出里连续的8个字节
+//每个通道记录子流当前读到的字节位置和字节内的比特位置，一轮里：
+//  用gather指令从每个通道的字节位置读4个字节，调整成大端，左移掉已经用过的比特，高TABLE_BITS比特就是窥视到的比特
+//  再用gather指令查解码表，得到单词和编码长度，位置往后移编码长度那么多比特
+//解码表的每个项目是32位整数，低8位是单词，8到15位是编码长度，编码长度是0的项目表示不是合法的编码
+//第3版格式的编码长度不超过解码表的比特数，所以查一次表一定能解出一个单词
+//
+//读4个字节可能会读过子流的末尾，调用者要在整个压缩内容后面多留至少4个字节
+//字节位置用32位整数，压缩内容不能超过2GB
+//不是x86或者编译器不是GCC的时候没有AVX2版本，simd_decode_supported总是返回false
+
+#ifndef SIMD_DECODER_H
+#define SIMD_DECODER_H
+
+#include <cstddef>//需要使用size_t
+#include <stdint.h>//需要使用uint32_t
+
+//AVX2解码的子流数
+#define SIMD_DECODE_STREAMS 8
+
+//压缩内容后面要多留的字节数
+#define SIMD_DECODE_PADDING 4
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SIMD_DECODER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef SIMD_DECODER_AVX2
+
+//解rounds轮，每轮每个子流解一个单词，结果按子流的顺序放到out里，一共rounds*8个字节
+//base是整个压缩内容，offset是每个子流当前的字节位置（相对base），shift是字节内已经用掉的比特数，解完以后更新它们
+//遇到不合法的编码返回false
+__attribute__((target("avx2")))
+inline bool simd_decode_interleaved(const unsigned char *base,const uint32_t *table,int table_bits,
+		int32_t offset[SIMD_DECODE_STREAMS],int32_t shift[SIMD_DECODE_STREAMS],unsigned char *out,size_t rounds)
+{
+	const int *words=reinterpret_cast<const int*>(base);
+	const int *entries=reinterpret_cast<const int*>(table);
+	//每32位里的4个字节倒过来，读进来的小端整数就变成了大端
+	const __m256i bswap=_mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	//每个通道的最低字节（单词）挪到每128比特的前4个字节
+	const __m256i pick=_mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+	const __m256i join=_mm256_setr_epi32(0,4,1,1,1,1,1,1);//把两个128比特里的4个字节接到一起
+	const __m256i seven=_mm256_set1_epi32(7);
+	const __m128i peek_shift=_mm_cvtsi32_si128(32-table_bits);
+	__m256i pos=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset));
+	__m256i bits=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(shift));
+	__m256i invalid=_mm256_setzero_si256();
+	for(size_t r=0;r<rounds;++r){
+		__m256i window=_mm256_shuffle_epi8(_mm256_i32gather_epi32(words,pos,1),bswap);
+		__m256i peek=_mm256_srl_epi32(_mm256_sllv_epi32(window,bits),peek_shift);
+		__m256i entry=_mm256_i32gather_epi32(entries,peek,4);
+		__m256i len=_mm256_srli_epi32(entry,8);
+		invalid=_mm256_or_si256(invalid,_mm256_cmpeq_epi32(len,_mm256_setzero_si256()));
+		bits=_mm256_add_epi32(bits,len);
+		pos=_mm256_add_epi32(pos,_mm256_srli_epi32(bits,3));
+		bits=_mm256_and_si256(bits,seven);
+		__m256i bytes=_mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(entry,pick),join);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out+r*SIMD_DECODE_STREAMS),_mm256_castsi256_si128(bytes));
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(offset),pos);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(shift),bits);
+	return _mm256_testz_si256(invalid,invalid)!=0;
+}
+
+//这台机器能不能用AVX2解码
+inline bool simd_decode_supported(){
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+inline bool simd_decode_interleaved(const unsigned char *,const uint32_t *,int,int32_t *,int32_t *,unsigned char *,size_t){
+	return false;
+}
+
+inline bool simd_decode_supported(){
+	return false;
+}
+
+#endif
+
+#endif
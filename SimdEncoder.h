@@ -0,0 +1,118 @@
+//SimdEncoder：用AVX2指令一次编码好几个单词
+//
+//BitWriter每写一个编码都要根据寄存器里已有的比特数算移位，下一个编码要等上一个写完才知道放在哪里，是串行的
+//这里每次取4个单词，用gather指令一次从编码表里取出4个编码，编码长度的后缀和就是每个编码要左移的位数
+//用向量移位把4个编码移到各自的位置，再OR到一起，就是4个编码接起来的结果，只要调用一次BitWriter::put
+//一次处理8个单词，也就是两组4个
+//4个编码接起来不能超过64比特，所以最长的编码不超过16比特时才能4个一组；不超过32比特时两个一组，每组调用一次put
+//写出来的比特流和一个一个单词调用put完全一样
+//
+//编码表是256个64比特的整数，低56比特是编码，高8比特是编码长度
+//不是x86或者编译器不是GCC的时候没有AVX2版本，simd_encode_supported总是返回false
+
+#ifndef SIMD_ENCODER_H
+#define SIMD_ENCODER_H
+
+#include <cstddef>//需要使用size_t
+#include <stdint.h>//需要使用uint64_t
+#include "BitWriter.h"
+
+//4个编码一组时最长的编码长度
+#define SIMD_ENCODE_GROUP4_MAX_CODE_LENGTH 16
+//2个编码一组时最长的编码长度，超过这个长度就不能用AVX2编码
+#define SIMD_ENCODE_MAX_CODE_LENGTH 32
+
+#if defined(__GNUC__) && defined(__x86_64__)//_mm_cvtsi128_si64和_mm_extract_epi64只有64位才有，32位用普通的版本
+#define SIMD_ENCODER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef SIMD_ENCODER_AVX2
+
+//把4个编码接起来，写到bw里，entries是从编码表里取出来的4个项目，第0个是最先写的
+__attribute__((target("avx2")))
+inline void simd_put_group(__m256i entries,BitWriter &bw){
+	const __m256i code_mask=_mm256_set1_epi64x((static_cast<uint64_t>(1)<<56)-1);
+	__m256i lens=_mm256_srli_epi64(entries,56);
+	__m256i codes=_mm256_and_si256(entries,code_mask);
+	//第i个编码要左移的位数是它后面所有编码的长度之和
+	//把长度依次往前挪1、2、3个位置（后面补0）加起来，就是后缀和
+	const __m256i zero=_mm256_setzero_si256();
+	__m256i next1=_mm256_blend_epi32(_mm256_permute4x64_epi64(lens,_MM_SHUFFLE(3,3,2,1)),zero,0xC0);
+	__m256i next2=_mm256_blend_epi32(_mm256_permute4x64_epi64(lens,_MM_SHUFFLE(3,3,3,2)),zero,0xF0);
+	__m256i next3=_mm256_blend_epi32(_mm256_permute4x64_epi64(lens,_MM_SHUFFLE(3,3,3,3)),zero,0xFC);
+	__m256i shifts=_mm256_add_epi64(_mm256_add_epi64(next1,next2),next3);
+	__m256i shifted=_mm256_sllv_epi64(codes,shifts);
+	//4个移好位置的编码互不重叠，OR到一起
+	__m128i half=_mm_or_si128(_mm256_castsi256_si128(shifted),_mm256_extracti128_si256(shifted,1));
+	uint64_t code=static_cast<uint64_t>(_mm_cvtsi128_si64(half))|static_cast<uint64_t>(_mm_extract_epi64(half,1));
+	//总长度是第0个编码的长度加上它要左移的位数
+	__m256i total=_mm256_add_epi64(lens,shifts);
+	int len=static_cast<int>(_mm_cvtsi128_si64(_mm256_castsi256_si128(total)));
+	bw.put(code,len);
+}
+
+//把4个编码两个两个接起来，分两次写到bw里
+__attribute__((target("avx2")))
+inline void simd_put_pairs(__m256i entries,BitWriter &bw){
+	const __m256i code_mask=_mm256_set1_epi64x((static_cast<uint64_t>(1)<<56)-1);
+	__m256i lens=_mm256_srli_epi64(entries,56);
+	__m256i codes=_mm256_and_si256(entries,code_mask);
+	//第0个和第2个编码要左移后面那个编码的长度，第1个和第3个不用移
+	const __m256i zero=_mm256_setzero_si256();
+	__m256i shifts=_mm256_blend_epi32(_mm256_permute4x64_epi64(lens,_MM_SHUFFLE(3,3,1,1)),zero,0xCC);
+	__m256i shifted=_mm256_sllv_epi64(codes,shifts);
+	//每128比特里的两个64比特交换一下再OR，第0个和第2个位置就是接好的两组
+	__m256i merged=_mm256_or_si256(shifted,_mm256_shuffle_epi32(shifted,_MM_SHUFFLE(1,0,3,2)));
+	__m256i total=_mm256_add_epi64(lens,shifts);
+	__m128i merged_high=_mm256_extracti128_si256(merged,1), total_high=_mm256_extracti128_si256(total,1);
+	bw.put(static_cast<uint64_t>(_mm_cvtsi128_si64(_mm256_castsi256_si128(merged))),static_cast<int>(_mm_cvtsi128_si64(_mm256_castsi256_si128(total))));
+	bw.put(static_cast<uint64_t>(_mm_cvtsi128_si64(merged_high)),static_cast<int>(_mm_cvtsi128_si64(total_high)));
+}
+
+//用AVX2编码in里的单词，每次8个，返回编码了多少个单词，剩下不满8个的由调用者自己编码
+//max_len是编码表里最长的编码，调用前要先用simd_encode_supported确认能用
+__attribute__((target("avx2")))
+inline size_t simd_encode(const uint64_t *table,const unsigned char *in,size_t n,int max_len,BitWriter &bw){
+	const long long *base=reinterpret_cast<const long long*>(table);
+	bool group4=(max_len<=SIMD_ENCODE_GROUP4_MAX_CODE_LENGTH);
+	size_t i=0;
+	for(;i+8<=n;i+=8){
+		//8个单词扩展成8个32位的下标，前4个和后4个分别取一次编码表
+		__m128i bytes=_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in+i));
+		__m256i index=_mm256_cvtepu8_epi32(bytes);
+		__m256i low=_mm256_i32gather_epi64(base,_mm256_castsi256_si128(index),8);
+		__m256i high=_mm256_i32gather_epi64(base,_mm256_extracti128_si256(index,1),8);
+		if(group4){
+			simd_put_group(low,bw);
+			simd_put_group(high,bw);
+		}else{
+			simd_put_pairs(low,bw);
+			simd_put_pairs(high,bw);
+		}
+	}
+	return i;
+}
+
+//这台机器能不能用AVX2编码，max_len是编码表里最长的编码
+inline bool simd_encode_supported(int max_len){
+	if(max_len>SIMD_ENCODE_MAX_CODE_LENGTH){
+		return false;
+	}
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+inline size_t simd_encode(const uint64_t *,const unsigned char *,size_t,int,BitWriter &){
+	return 0;
+}
+
+inline bool simd_encode_supported(int){
+	return false;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,141 @@
+//ThreadPool：固定数量的工作线程，把一批互相独立的任务分给它们做
+//
+//run(task,arg,count)对0到count-1的每个下标调用一次task(arg,下标)，所有下标都做完才返回
+//下标用原子操作一个一个领取，先做完的线程接着领下一个，任务大小不一样的时候也不会有线程闲着
+//调用run的线程自己也领任务做，所以threads个线程的池只另外创建threads-1个工作线程，threads是1的时候不创建线程
+//工作线程在两次run之间睡在条件变量上，池销毁的时候才退出
+//同一时间只能有一个线程调用run
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <unistd.h>//需要使用sysconf
+#include <vector>
+
+class ThreadPool
+{
+public:
+	typedef void (*Task)(void *arg,long index);
+
+	explicit ThreadPool(int threads)
+		:task_(0),arg_(0),count_(0),next_(0),pending_(0),generation_(0),stop_(false)
+	{
+		pthread_mutex_init(&mutex_,0);
+		pthread_cond_init(&start_,0);
+		pthread_cond_init(&done_,0);
+		for(int i=1;i<threads;++i){
+			pthread_t t;
+			if(pthread_create(&t,0,worker_main,this)!=0){//创建不了就少用几个线程，调用run的线程总能把任务做完
+				break;
+			}
+			workers_.push_back(t);
+		}
+	}
+
+	~ThreadPool(){
+		pthread_mutex_lock(&mutex_);
+		stop_=true;
+		pthread_cond_broadcast(&start_);
+		pthread_mutex_unlock(&mutex_);
+		for(size_t i=0;i<workers_.size();++i){
+			pthread_join(workers_[i],0);
+		}
+		pthread_cond_destroy(&done_);
+		pthread_cond_destroy(&start_);
+		pthread_mutex_destroy(&mutex_);
+	}
+
+	//线程总数，包括调用run的线程
+	int size() const{
+		return static_cast<int>(workers_.size())+1;
+	}
+
+	void run(Task task,void *arg,long count){
+		if(count<=0){
+			return;
+		}
+		pthread_mutex_lock(&mutex_);
+		task_=task;
+		arg_=arg;
+		count_=count;
+		next_=0;
+		pending_=count;
+		++generation_;
+		pthread_cond_broadcast(&start_);
+		pthread_mutex_unlock(&mutex_);
+
+		work();
+
+		pthread_mutex_lock(&mutex_);
+		while(pending_>0){
+			pthread_cond_wait(&done_,&mutex_);
+		}
+		pthread_mutex_unlock(&mutex_);
+	}
+
+	//机器上的CPU数，取不到的时候是1
+	static int cpu_count(){
+		long n=sysconf(_SC_NPROCESSORS_ONLN);
+		return n>0 ? static_cast<int>(n) : 1;
+	}
+
+private:
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+	//领任务做，直到这一批的下标都领完
+	void work(){
+		long finished=0;
+		for(;;){
+			long i=__sync_fetch_and_add(&next_,1);
+			if(i>=count_){
+				break;
+			}
+			task_(arg_,i);
+			++finished;
+		}
+		if(finished>0){
+			pthread_mutex_lock(&mutex_);
+			pending_-=finished;
+			if(pending_==0){
+				pthread_cond_signal(&done_);
+			}
+			pthread_mutex_unlock(&mutex_);
+		}
+	}
+
+	static void *worker_main(void *p){
+		ThreadPool *pool=static_cast<ThreadPool*>(p);
+		unsigned long seen=0;//做过的最后一批
+		pthread_mutex_lock(&pool->mutex_);
+		for(;;){
+			while(!pool->stop_ && pool->generation_==seen){
+				pthread_cond_wait(&pool->start_,&pool->mutex_);
+			}
+			if(pool->stop_){
+				break;
+			}
+			seen=pool->generation_;
+			pthread_mutex_unlock(&pool->mutex_);
+			pool->work();
+			pthread_mutex_lock(&pool->mutex_);
+		}
+		pthread_mutex_unlock(&pool->mutex_);
+		return 0;
+	}
+
+	std::vector<pthread_t> workers_;
+	pthread_mutex_t mutex_;
+	pthread_cond_t start_;//有新的一批任务
+	pthread_cond_t done_;//这一批任务都做完了
+	Task task_;
+	void *arg_;
+	long count_;
+	volatile long next_;//下一个要领的下标
+	long pending_;//还没做完的任务数
+	unsigned long generation_;//第几批任务
+	bool stop_;
+};
+
+#endif
@@ -0,0 +1,540 @@
+//UringIO：用io_uring提前提交好几个读请求、异步提交写请求的ByteSource和ByteSink
+//
+//ByteIO.h里的FdSource、FdSink每次read、write都是一次同步的系统调用，编码的线程要等它返回才能接着编码
+//UringSource打开普通文件以后，一次提交URING_QUEUE_DEPTH个读请求，每个读URING_BUFFER_SIZE字节，编码器用完一个缓冲区就把它再提交去读后面的内容，
+//所以编码的时候总有几个读请求在后台进行；UringSink攒满一个缓冲区就提交一个写请求，不等它完成，只有缓冲区都在写的时候才等
+//缓冲区事先用IORING_REGISTER_BUFFERS注册，内核不用每次读写都重新锁定页面；注册失败（比如RLIMIT_MEMLOCK太小）的时候用普通的读写请求
+//
+//编译的时候定义HUFFMAN_IO_URING并且有<linux/io_uring.h>才用io_uring，直接用系统调用，不需要liburing
+//没编译进来，或者内核不支持（io_uring_setup失败）的时候，退回到普通的pread、pwrite，读写的结果完全一样，uring()返回false
+//只支持普通文件，读写的位置都是事先算好的，管道之类的文件调用者要用别的ByteSource、ByteSink
+
+#ifndef URING_IO_H
+#define URING_IO_H
+
+#include <vector>//需要使用向量
+#include <cstring>//需要使用memset、memcpy
+#include <cstddef>//需要使用size_t
+#include <cerrno>//需要使用errno
+#include <fcntl.h>//需要使用open
+#include <unistd.h>//需要使用pread、pwrite
+#include <sys/stat.h>//需要使用fstat
+#include "ByteIO.h"
+
+//同时进行的读（写）请求数，以及每个请求的字节数
+#define URING_QUEUE_DEPTH 8
+#define URING_BUFFER_SIZE (1L<<20)
+
+#if defined(HUFFMAN_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_IO_ENABLED 1
+#endif
+#endif
+
+#ifdef URING_IO_ENABLED
+#include <linux/io_uring.h>
+#include <sys/syscall.h>//需要使用syscall
+#include <sys/mman.h>//需要使用mmap
+#include <sys/uio.h>//需要使用iovec
+#endif
+
+//从offset开始读满size个字节，读到文件末尾返回实际读到的字节数，出错返回-1
+inline long uring_pread_full(int fd,unsigned char *buf,size_t size,unsigned long long offset){
+	size_t done=0;
+	while(done<size){
+		ssize_t n=pread(fd,buf+done,size-done,offset+done);
+		if(n<0 && errno==EINTR){
+			continue;
+		}
+		if(n<0){
+			return -1;
+		}
+		if(n==0){
+			break;
+		}
+		done+=n;
+	}
+	return done;
+}
+
+//把size个字节写到offset处，写不完返回false
+inline bool uring_pwrite_full(int fd,const unsigned char *buf,size_t size,unsigned long long offset){
+	while(size>0){
+		ssize_t n=pwrite(fd,buf,size,offset);
+		if(n<0 && errno==EINTR){
+			continue;
+		}
+		if(n<=0){
+			return false;
+		}
+		buf+=n;
+		size-=n;
+		offset+=n;
+	}
+	return true;
+}
+
+//一个缓冲区和它上面的读写请求
+struct UringSlot{
+	std::vector<unsigned char> data;
+	unsigned long long offset;//在文件里的位置
+	size_t size;//要读写的字节数
+	bool busy;//已经提交了请求
+	bool done;//请求完成了
+	int result;//请求的结果，读写的字节数或者负的错误码
+};
+
+#ifdef URING_IO_ENABLED
+
+//io_uring的提交队列和完成队列，直接用系统调用，只用到这里需要的一点功能
+class UringQueue
+{
+public:
+	UringQueue()
+		:fd_(-1),sq_ptr_(MAP_FAILED),cq_ptr_(MAP_FAILED),sqes_(MAP_FAILED),sq_size_(0),cq_size_(0),sqes_size_(0),sqe_tail_(0),to_submit_(0),registered_(false)
+	{
+	}
+
+	~UringQueue(){
+		if(sqes_!=MAP_FAILED){
+			munmap(sqes_,sqes_size_);
+		}
+		if(cq_ptr_!=MAP_FAILED && cq_ptr_!=sq_ptr_){
+			munmap(cq_ptr_,cq_size_);
+		}
+		if(sq_ptr_!=MAP_FAILED){
+			munmap(sq_ptr_,sq_size_);
+		}
+		if(fd_>=0){
+			close(fd_);
+		}
+	}
+
+	//创建有entries项的队列，把两个队列和提交项数组映射进来，内核不支持的时候返回false
+	bool init(unsigned entries){
+		io_uring_params p;
+		memset(&p,0,sizeof(p));
+		fd_=syscall(__NR_io_uring_setup,entries,&p);
+		if(fd_<0){
+			return false;
+		}
+		sq_size_=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+		cq_size_=p.cq_off.cqes+p.cq_entries*sizeof(io_uring_cqe);
+		bool single=(p.features&IORING_FEAT_SINGLE_MMAP)!=0;//两个队列在一次映射里
+		if(single){
+			sq_size_=cq_size_=(sq_size_>cq_size_ ? sq_size_ : cq_size_);
+		}
+		sq_ptr_=mmap(0,sq_size_,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd_,IORING_OFF_SQ_RING);
+		if(sq_ptr_==MAP_FAILED){
+			return false;
+		}
+		cq_ptr_=(single ? sq_ptr_ : mmap(0,cq_size_,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd_,IORING_OFF_CQ_RING));
+		if(cq_ptr_==MAP_FAILED){
+			return false;
+		}
+		sqes_size_=p.sq_entries*sizeof(io_uring_sqe);
+		sqes_=mmap(0,sqes_size_,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd_,IORING_OFF_SQES);
+		if(sqes_==MAP_FAILED){
+			return false;
+		}
+		char *sq=static_cast<char*>(sq_ptr_);
+		sq_head_=reinterpret_cast<unsigned*>(sq+p.sq_off.head);
+		sq_tail_=reinterpret_cast<unsigned*>(sq+p.sq_off.tail);
+		sq_mask_=*reinterpret_cast<unsigned*>(sq+p.sq_off.ring_mask);
+		sq_array_=reinterpret_cast<unsigned*>(sq+p.sq_off.array);
+		sq_entries_=p.sq_entries;
+		char *cq=static_cast<char*>(cq_ptr_);
+		cq_head_=reinterpret_cast<unsigned*>(cq+p.cq_off.head);
+		cq_tail_=reinterpret_cast<unsigned*>(cq+p.cq_off.tail);
+		cq_mask_=*reinterpret_cast<unsigned*>(cq+p.cq_off.ring_mask);
+		cqes_=reinterpret_cast<io_uring_cqe*>(cq+p.cq_off.cqes);
+		sqe_tail_=*sq_tail_;
+		return true;
+	}
+
+	//注册slots的缓冲区，以后用READ_FIXED、WRITE_FIXED读写，失败的时候用普通的读写请求
+	void register_buffers(std::vector<UringSlot> &slots){
+		std::vector<iovec> iov(slots.size());
+		for(size_t i=0;i<slots.size();++i){
+			iov[i].iov_base=&slots[i].data[0];
+			iov[i].iov_len=slots[i].data.size();
+		}
+		registered_=(syscall(__NR_io_uring_register,fd_,IORING_REGISTER_BUFFERS,&iov[0],static_cast<unsigned>(iov.size()))==0);
+	}
+
+	//准备第index个缓冲区的读写请求，完成的时候user_data是index，提交队列满了返回false
+	bool prepare(bool write,int fd,UringSlot &slot,unsigned index){
+		unsigned tail=sqe_tail_;
+		if(tail-__atomic_load_n(sq_head_,__ATOMIC_ACQUIRE)>=sq_entries_){
+			return false;
+		}
+		unsigned i=tail&sq_mask_;
+		io_uring_sqe *sqe=static_cast<io_uring_sqe*>(sqes_)+i;
+		memset(sqe,0,sizeof(*sqe));
+		if(registered_){
+			sqe->opcode=(write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED);
+			sqe->buf_index=index;
+		}else{
+			sqe->opcode=(write ? IORING_OP_WRITE : IORING_OP_READ);
+		}
+		sqe->fd=fd;
+		sqe->addr=reinterpret_cast<unsigned long>(&slot.data[0]);
+		sqe->len=slot.size;
+		sqe->off=slot.offset;
+		sqe->user_data=index;
+		sq_array_[i]=i;
+		sqe_tail_=tail+1;
+		__atomic_store_n(sq_tail_,sqe_tail_,__ATOMIC_RELEASE);//提交项写好以后才让内核看到
+		++to_submit_;
+		return true;
+	}
+
+	//提交准备好的请求，wait是true的时候至少等到一个请求完成
+	bool submit(bool wait){
+		for(;;){
+			int n=syscall(__NR_io_uring_enter,fd_,to_submit_,wait ? 1 : 0,wait ? IORING_ENTER_GETEVENTS : 0,0,0);
+			if(n>=0){
+				to_submit_-=n;
+				return true;
+			}
+			if(errno!=EINTR){
+				return false;
+			}
+		}
+	}
+
+	//取一个完成了的请求，没有的时候返回false
+	bool reap(unsigned &index,int &result){
+		unsigned head=*cq_head_;
+		if(head==__atomic_load_n(cq_tail_,__ATOMIC_ACQUIRE)){
+			return false;
+		}
+		const io_uring_cqe &cqe=cqes_[head&cq_mask_];
+		index=static_cast<unsigned>(cqe.user_data);
+		result=cqe.res;
+		__atomic_store_n(cq_head_,head+1,__ATOMIC_RELEASE);//读完以后才让内核覆盖这一项
+		return true;
+	}
+
+private:
+	UringQueue(const UringQueue &);
+	UringQueue &operator=(const UringQueue &);
+
+	int fd_;
+	void *sq_ptr_;
+	void *cq_ptr_;
+	void *sqes_;
+	size_t sq_size_;
+	size_t cq_size_;
+	size_t sqes_size_;
+	unsigned *sq_head_;
+	unsigned *sq_tail_;
+	unsigned sq_mask_;
+	unsigned *sq_array_;
+	unsigned sq_entries_;
+	unsigned *cq_head_;
+	unsigned *cq_tail_;
+	unsigned cq_mask_;
+	io_uring_cqe *cqes_;
+	unsigned sqe_tail_;//下一个提交项的位置
+	unsigned to_submit_;//准备好了还没提交的请求数
+	bool registered_;
+};
+
+#else
+
+//没有io_uring的时候只是占个位置，init总是失败
+class UringQueue
+{
+public:
+	bool init(unsigned){
+		return false;
+	}
+	void register_buffers(std::vector<UringSlot> &){
+	}
+	bool prepare(bool,int,UringSlot &,unsigned){
+		return false;
+	}
+	bool submit(bool){
+		return false;
+	}
+	bool reap(unsigned &,int &){
+		return false;
+	}
+};
+
+#endif
+
+//UringSource和UringSink共用的部分：打开的文件、缓冲区和队列
+class UringFile
+{
+public:
+	UringFile()
+		:fd_(-1),ring_(false),slots_(URING_QUEUE_DEPTH)
+	{
+		for(size_t i=0;i<slots_.size();++i){
+			slots_[i].data.resize(URING_BUFFER_SIZE);
+			slots_[i].offset=0;
+			slots_[i].size=0;
+			slots_[i].busy=false;
+			slots_[i].done=false;
+			slots_[i].result=0;
+		}
+	}
+
+	~UringFile(){
+		//内核可能还在往缓冲区里读写，等所有的请求都完成了才能释放缓冲区
+		for(size_t i=0;i<slots_.size();++i){
+			wait(i);
+		}
+		if(fd_>=0){
+			close(fd_);
+		}
+	}
+
+	//是否真的在用io_uring，false表示退回到了pread、pwrite
+	bool uring() const{
+		return ring_;
+	}
+
+	int fd() const{
+		return fd_;
+	}
+
+protected:
+	//打开了fd以后调用，创建队列、注册缓冲区
+	void start_ring(){
+		ring_=queue_.init(URING_QUEUE_DEPTH*2);
+		if(ring_){
+			queue_.register_buffers(slots_);
+		}
+	}
+
+	//提交第i个缓冲区的读写请求，不用io_uring的时候直接同步读写
+	bool submit(size_t i,bool write){
+		UringSlot &slot=slots_[i];
+		slot.busy=true;
+		slot.done=false;
+		if(ring_ && queue_.prepare(write,fd_,slot,i)){
+			if(queue_.submit(false)==false){
+				slot.done=true;
+				slot.result=-EIO;
+			}
+			return true;
+		}
+		long n=(write ? (uring_pwrite_full(fd_,&slot.data[0],slot.size,slot.offset) ? static_cast<long>(slot.size) : -1)
+			: uring_pread_full(fd_,&slot.data[0],slot.size,slot.offset));
+		slot.done=true;
+		slot.result=(n<0 ? -EIO : static_cast<int>(n));
+		return true;
+	}
+
+	//等第i个缓冲区的请求完成，只读写了一部分的时候同步读写剩下的部分，出错返回false
+	bool wait(size_t i){
+		UringSlot &slot=slots_[i];
+		if(slot.busy==false){
+			return true;
+		}
+		while(slot.done==false){
+			unsigned index=0;
+			int result=0;
+			if(queue_.reap(index,result)){
+				slots_[index].done=true;
+				slots_[index].result=result;
+			}else if(queue_.submit(true)==false){
+				slot.busy=false;
+				return false;
+			}
+		}
+		slot.busy=false;
+		if(slot.result<0){
+			return false;
+		}
+		size_t done=slot.result;
+		if(done<slot.size){//只读写了一部分
+			long n=(write_ ? (uring_pwrite_full(fd_,&slot.data[0]+done,slot.size-done,slot.offset+done) ? static_cast<long>(slot.size-done) : -1)
+				: uring_pread_full(fd_,&slot.data[0]+done,slot.size-done,slot.offset+done));
+			if(n<0){
+				return false;
+			}
+			slot.size=done+n;
+		}
+		return true;
+	}
+
+	int fd_;
+	bool ring_;
+	bool write_;//是写文件
+	std::vector<UringSlot> slots_;
+	UringQueue queue_;//在slots_后面，先于缓冲区销毁
+};
+
+//用io_uring读普通文件，编码器取走一个缓冲区里的内容以后，这个缓冲区马上再提交去读后面的内容
+class UringSource : public ByteSource, public UringFile
+{
+public:
+	UringSource()
+		:size_(0),next_offset_(0),current_(0),pos_(0),valid_(false)
+	{
+		write_=false;
+	}
+
+	//打开filename，从offset开始读，不是普通文件的时候返回false
+	bool open(const char *filename,unsigned long long offset){
+		fd_=::open(filename,O_RDONLY);
+		struct stat st;
+		if(fd_<0 || fstat(fd_,&st)!=0 || !S_ISREG(st.st_mode)){
+			return false;
+		}
+		size_=st.st_size;
+		next_offset_=offset;
+		start_ring();
+		for(size_t i=0;i<slots_.size();++i){
+			submit_read(i);
+		}
+		return true;
+	}
+
+	virtual const unsigned char *next(size_t max,size_t &n){
+		if(current()){
+			const UringSlot &slot=slots_[current_];
+			size_t rest=slot.size-pos_;
+			if(rest>=max || slot.offset+slot.size>=size_){//这个缓冲区里够了，或者这是文件最后一段
+				n=(rest<max ? rest : max);
+				const unsigned char *p=&slot.data[0]+pos_;
+				pos_+=n;
+				return p;
+			}
+		}
+		return ByteSource::next(max,n);
+	}
+
+protected:
+	virtual size_t fill(unsigned char *buf,size_t size){
+		if(!current()){
+			return 0;
+		}
+		const UringSlot &slot=slots_[current_];
+		size_t n=slot.size-pos_;
+		if(n>size){
+			n=size;
+		}
+		memcpy(buf,&slot.data[0]+pos_,n);
+		pos_+=n;
+		return n;
+	}
+
+private:
+	//第i个缓冲区去读下一段，读完了就不再提交
+	void submit_read(size_t i){
+		if(next_offset_>=size_){
+			slots_[i].busy=false;
+			return;
+		}
+		slots_[i].offset=next_offset_;
+		slots_[i].size=(size_-next_offset_<static_cast<unsigned long long>(URING_BUFFER_SIZE) ? size_-next_offset_ : URING_BUFFER_SIZE);
+		next_offset_+=slots_[i].size;
+		submit(i,false);
+	}
+
+	//保证当前的缓冲区里还有没取的字节，取完的缓冲区再提交去读，读完了返回false
+	bool current(){
+		if(valid_ && pos_<slots_[current_].size){
+			return true;
+		}
+		if(valid_){
+			submit_read(current_);
+			current_=(current_+1)%slots_.size();
+			valid_=false;
+		}
+		if(slots_[current_].busy==false){//后面没有了
+			return false;
+		}
+		if(wait(current_)==false){
+			failed_=true;
+			return false;
+		}
+		valid_=true;
+		pos_=0;
+		return slots_[current_].size>0;
+	}
+
+	unsigned long long size_;//文件大小
+	unsigned long long next_offset_;//下一个读请求的位置
+	size_t current_;//正在取的缓冲区，缓冲区按顺序轮流使用
+	size_t pos_;//当前缓冲区里下一个要取的字节
+	bool valid_;//当前缓冲区已经读好了
+};
+
+//用io_uring写普通文件，攒满一个缓冲区就提交一个写请求，不等它完成，写完以后要调用finish
+class UringSink : public ByteSink, public UringFile
+{
+public:
+	UringSink()
+		:offset_(0),current_(0),failed_(false)
+	{
+		write_=true;
+	}
+
+	//创建（或者清空）filename，从offset开始写，前面的部分调用者用fd()自己写，不是普通文件的时候返回false
+	bool open(const char *filename,unsigned long long offset){
+		fd_=::open(filename,O_WRONLY|O_CREAT|O_TRUNC,0666);
+		struct stat st;
+		if(fd_<0 || fstat(fd_,&st)!=0 || !S_ISREG(st.st_mode)){
+			return false;
+		}
+		offset_=offset;
+		slots_[0].size=0;
+		start_ring();
+		return true;
+	}
+
+	virtual bool write(const unsigned char *data,size_t n){
+		while(n>0 && failed_==false){
+			UringSlot &slot=slots_[current_];
+			size_t room=slot.data.size()-slot.size;
+			size_t len=(n<room ? n : room);
+			memcpy(&slot.data[0]+slot.size,data,len);
+			slot.size+=len;
+			data+=len;
+			n-=len;
+			if(slot.size==slot.data.size()){
+				submit_current();
+			}
+		}
+		return failed_==false;
+	}
+
+	//提交最后没攒满的缓冲区，等所有的写请求完成
+	bool finish(){
+		if(failed_==false && slots_[current_].size>0){
+			submit_current();
+		}
+		for(size_t i=0;i<slots_.size();++i){
+			if(wait(i)==false){
+				failed_=true;
+			}
+		}
+		return failed_==false;
+	}
+
+private:
+	//提交当前的缓冲区，换到下一个缓冲区，它上一次的写请求还没完成的时候等着
+	void submit_current(){
+		UringSlot &slot=slots_[current_];
+		slot.offset=offset_;
+		offset_+=slot.size;
+		submit(current_,true);
+		current_=(current_+1)%slots_.size();
+		if(wait(current_)==false){
+			failed_=true;
+		}
+		slots_[current_].size=0;
+	}
+
+	unsigned long long offset_;//下一个写请求的位置
+	size_t current_;//正在攒的缓冲区
+	bool failed_;
+};
+
+#endif
@@ -2,18 +2,67 @@
 
 #include <iostream>//基本流操作
 #include <fstream>//文件
+#include <sstream>//需要使用ostringstream
 #include <vector>//需要使用向量
 #include <algorithm>//需要使用标准库的几个算法
 #include <limits>//需要使用long最大值
 #include <cstdlib>//需要使用system函数
+#include <cstring>//需要使用memcpy、strcmp
+#include <cerrno>//需要使用errno
+#include <cmath>//需要使用ldexp
+#include <time.h>//需要使用clock_gettime计时
+#include <stdint.h>//需要使用uint64_t
+#include <fcntl.h>//需要使用open
+#include <unistd.h>//需要使用pread、pwrite
+#include <sys/stat.h>//需要使用fstat
+#include <sys/mman.h>//需要使用mmap
 #include "Bitstream.imp.h"//使用了开源的Bitstream库
+#include "BitWriter.h"//一次写一整个编码的比特流输出
+#include "BitReader.h"//一次补充64比特窗口的比特流输入
+#include "ByteIO.h"//编码和解码的内核读写字节用的Source/Sink
+#include "SimdEncoder.h"//用AVX2一次编码8个单词
+#include "SimdDecoder.h"//用AVX2同时解码8个子比特流
+#include "Histogram.h"//用几张交错的计数表统计字节出现的次数
+#include "HuffmanBuilder.h"//排序以后用两个队列线性时间地建huffman树
+#include "ThreadPool.h"//多线程压缩用的线程池
+#include "Pipeline.h"//读、编解码、写三个线程的流水线
+#include "UringIO.h"//用io_uring批量异步读写文件
 
 //每个压缩文件的文件头都设置为下面的字符串，用以识别文件是否是本程序压缩过的文件
 #define MAGIC_VERSION "huffman zipped file version 1"
+//第2版格式只存每个单词的编码长度，用范式huffman编码，和字节序、long的长度都无关
+#define MAGIC_VERSION_2 "huffman zipped file version 2"
+//第3版格式和第2版一样存编码长度，但是单词轮流放到几个子比特流里，解码的时候几个子流可以同时解
+#define MAGIC_VERSION_3 "huffman zipped file version 3"
+//第4版格式把输入切成块，每块单独建huffman树和编码，可以多线程压缩
+#define MAGIC_VERSION_4 "huffman zipped file version 4"
+//编码表把编码和编码长度打包在一个64比特的整数里，所以编码长度不能超过56，更长的编码用package-merge算法限制长度
+#define MAX_CODE_LENGTH 56
+
+//压缩以后估计至少要比原来小这么多（百分比），否则不压缩，直接存储
+#define STORED_MIN_GAIN_PERCENT 2
 
 using namespace std;
 using namespace Costella;//使用了开源的Bitstream库，这个库的内容全在此名称空间里
 
+//命令行选项
+struct HuffmanOptions{
+	bool decompress;//true表示解压缩，false表示压缩
+	bool verbose;//是否输出耗时和速度
+	int encode_table;//编码表的种类
+	int decode_table;//解码表的种类
+	int format;//压缩文件格式的版本，1、2、3或4
+	bool format_given;//命令行上用--format指定了格式
+	int streams;//第3版格式的子比特流数，4或8
+	long block_size;//第4版格式每块的大小，单位是字节
+	int threads;//压缩和解压缩用的线程数
+	int max_code_length;//限制编码的最大长度，0表示不限制
+	bool fast;//只用采样的数据统计词汇表，输入只读一遍
+	bool mmap;//输入输出是普通文件的时候映射到内存里读写
+	bool pipeline;//读和写各用一个线程，和编解码同时进行
+	bool io_uring;//普通文件用io_uring读写，不映射到内存里
+};
+
 //huffman树的一个节点
 struct HuffmanNode{
 	long lchild;//左孩子下标
@@ -28,15 +77,16 @@ struct HuffmanToken{
 	long weight;//权重
 };
 
-//编码表的一个项目
+//编码表的一个项目，编码和编码长度打包在8个字节里，256个单词的编码表只有2KB，能一直待在缓存里
 struct HuffmanCode{
-	unsigned char byte;//单词
-	vector<int> code;//单词对应编码，由一连串的0、1序列组成
+	uint64_t code:56;//单词对应编码，编码的第一个比特在最高位，写的时候可以一次写整个编码
+	uint64_t len:8;//编码长度，没在词汇表中的单词是0
 };
 
 typedef vector<HuffmanNode> HuffmanTree;//huffman树
 typedef vector<HuffmanToken> TokenList;//词汇表
-typedef vector<HuffmanCode> HuffmanCodes;//编码表
+typedef vector<HuffmanCode> HuffmanCodes;//编码表，下标是单词（字节）的值
+typedef vector<int> HuffmanCodeLengths;//每个单词的编码长度，下标是单词（字节）的值，没出现过的单词长度为0
 
 //检测词汇表项目的权重是否是0
 bool is_empty_token(const HuffmanToken &tk){
@@ -52,6 +102,13 @@ bool compare_HuffmanToken(const HuffmanToken &ht1,const HuffmanToken &ht2){
 	return (ht1.byte==ht2.byte) && (ht1.weight==ht2.weight);
 }*/
 
+//取当前时间，单位是秒，用来计算耗时
+double now_seconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
 //遍历输入文件，建立词汇表
 TokenList collect_word_list(istream &in){
 	TokenList tokens;
@@ -76,6 +133,349 @@ TokenList collect_word_list(istream &in){
 	return result_tokens;
 }
 
+//从每个单词的计数得到词汇表，和collect_word_list一样只留下出现过的单词
+TokenList tokens_from_counts(const long counts[256]){
+	TokenList tokens;
+	for(int i=0;i<256;++i){
+		if(counts[i]>0){
+			HuffmanToken token={static_cast<unsigned char>(i),counts[i]};
+			tokens.push_back(token);
+		}
+	}
+	return tokens;
+}
+
+//只读映射的整个输入文件，对象销毁的时候解除映射
+class MappedFile
+{
+public:
+	MappedFile()
+		:data_(0),size_(0)
+	{
+	}
+
+	~MappedFile(){
+		if(data_!=0){
+			munmap(data_,size_);
+		}
+	}
+
+	//映射filename，告诉内核会顺序读，文件不是普通文件、是空的或者映射失败的时候返回false，调用者改用输入流
+	bool map(const char *filename){
+		int fd=open(filename,O_RDONLY);
+		if(fd<0){
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd,&st)==0 && S_ISREG(st.st_mode) && st.st_size>0){
+			void *p=mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+			if(p!=MAP_FAILED){
+				madvise(p,st.st_size,MADV_SEQUENTIAL);
+				data_=p;
+				size_=st.st_size;
+			}
+		}
+		close(fd);
+		return data_!=0;
+	}
+
+	const unsigned char *data() const{
+		return static_cast<const unsigned char*>(data_);
+	}
+
+	size_t size() const{
+		return size_;
+	}
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	void *data_;
+	size_t size_;
+};
+
+//从一块内存里读的streambuf，用来从读进内存的块里解析块头，或者读映射到内存里的输入文件
+//可以移动位置，remaining_stream_size能求出剩下的字节数
+class MemoryInBuf : public streambuf
+{
+public:
+	MemoryInBuf(const unsigned char *begin,size_t size){
+		char *p=const_cast<char*>(reinterpret_cast<const char*>(begin));
+		setg(p,p,p+size);
+	}
+	//已经读了多少字节
+	size_t consumed() const{
+		return gptr()-eback();
+	}
+	//不复制，直接取出后面的size个字节，返回它们开始的地方，剩下的不够的时候返回0
+	const unsigned char *take(size_t size){
+		if(static_cast<size_t>(egptr()-gptr())<size){
+			return 0;
+		}
+		const unsigned char *p=reinterpret_cast<const unsigned char*>(gptr());
+		setg(eback(),gptr()+size,egptr());
+		return p;
+	}
+
+protected:
+	virtual streampos seekoff(streamoff off,ios_base::seekdir dir,ios_base::openmode which=ios_base::in){
+		if((which&ios_base::in)==0){
+			return streampos(-1);
+		}
+		streamoff base=(dir==ios_base::beg ? 0 : (dir==ios_base::cur ? gptr()-eback() : egptr()-eback()));
+		streamoff pos=base+off;
+		if(pos<0 || pos>egptr()-eback()){
+			return streampos(-1);
+		}
+		setg(eback(),eback()+pos,egptr());
+		return streampos(pos);
+	}
+	virtual streampos seekpos(streampos pos,ios_base::openmode which=ios_base::in){
+		return seekoff(streamoff(pos),ios_base::beg,which);
+	}
+};
+
+//从in里读size个字节的压缩内容，in是MemoryInBuf（映射到内存的输入）的时候不复制，直接返回映射里的位置
+//否则读到copy里，返回copy的开头，读不满的时候返回0
+const unsigned char *read_payload(istream &in,size_t size,vector<unsigned char> &copy){
+	MemoryInBuf *mem=dynamic_cast<MemoryInBuf*>(in.rdbuf());
+	if(mem!=0){
+		return mem->take(size);
+	}
+	copy.resize(size);
+	if(!in.read(reinterpret_cast<char*>(&copy[0]),size)){
+		return 0;
+	}
+	return &copy[0];
+}
+
+//输出文件能不能映射：已经存在的普通文件或者还不存在的文件可以，管道、终端这样的特殊文件不行
+bool can_map_output(const char *filename){
+	struct stat st;
+	if(stat(filename,&st)!=0){
+		return errno==ENOENT;
+	}
+	return S_ISREG(st.st_mode);
+}
+
+//输入文件是不是普通文件，普通文件才能倒回开头再读一遍
+bool is_regular_file(const char *filename){
+	struct stat st;
+	return stat(filename,&st)==0 && S_ISREG(st.st_mode);
+}
+
+//命令行上的-换成的文件名，打开的就是标准输入和标准输出
+#define STDIN_FILENAME "/dev/stdin"
+#define STDOUT_FILENAME "/dev/stdout"
+
+//文件名是标准输入或标准输出的时候返回它的文件描述符，这时直接用FdSource、FdSink读写，否则返回-1
+int stdio_fd(const char *filename){
+	if(strcmp(filename,STDIN_FILENAME)==0){
+		return STDIN_FILENO;
+	}
+	if(strcmp(filename,STDOUT_FILENAME)==0){
+		return STDOUT_FILENO;
+	}
+	return -1;
+}
+
+//多线程统计词汇表时每个任务统计的字节数，以及每次从文件里读的字节数
+#define HISTOGRAM_CHUNK_SIZE (8L<<20)
+#define HISTOGRAM_READ_SIZE (256L<<10)
+
+//一批要多线程统计的文件内容
+struct HistogramBatch{
+	const unsigned char *data;//映射到内存的输入，没有映射的时候是0，用pread从fd里读
+	int fd;//输入文件
+	long size;//文件的字节数
+	vector<long> counts;//每段自己的统计结果，第i段在i*256开始的256个数里
+	vector<char> ok;//每段是否读成功
+};
+
+//线程池里的任务：统计第index段，统计到这一段自己的256个计数里，不和别的线程共用任何计数
+void histogram_task(void *arg,long index){
+	HistogramBatch *batch=static_cast<HistogramBatch*>(arg);
+	long offset=index*HISTOGRAM_CHUNK_SIZE;
+	long end=min(offset+HISTOGRAM_CHUNK_SIZE,batch->size);
+	long counts[256]={0};
+	if(batch->data!=0){//输入映射到了内存里，直接统计
+		histogram_count(batch->data+offset,end-offset,counts);
+	}else{//用pread读
+		vector<unsigned char> buf(HISTOGRAM_READ_SIZE);
+		while(offset<end){
+			ssize_t n=pread(batch->fd,&buf[0],min(HISTOGRAM_READ_SIZE,end-offset),offset);
+			if(n<=0){
+				return;
+			}
+			histogram_count(&buf[0],n,counts);
+			offset+=n;
+		}
+	}
+	copy(counts,counts+256,batch->counts.begin()+index*256);
+	batch->ok[index]=1;
+}
+
+//用线程池统计batch里的每一段，再把每段的计数加起来得到词汇表，有一段读失败就返回false
+bool run_histogram_batch(HistogramBatch &batch,int threads,TokenList &tokens){
+	long chunks=(batch.size+HISTOGRAM_CHUNK_SIZE-1)/HISTOGRAM_CHUNK_SIZE;
+	batch.counts.assign(chunks*256,0);
+	batch.ok.assign(chunks,0);
+	ThreadPool pool(threads);
+	pool.run(histogram_task,&batch,chunks);
+	if(find(batch.ok.begin(),batch.ok.end(),0)!=batch.ok.end()){
+		return false;
+	}
+	long counts[256]={0};
+	for(long i=0;i<chunks;++i){
+		for(int b=0;b<256;++b){
+			counts[b]+=batch.counts[i*256+b];
+		}
+	}
+	tokens=tokens_from_counts(counts);
+	return true;
+}
+
+//多线程统计输入文件的词汇表，结果和collect_word_list一样
+//把文件切成HISTOGRAM_CHUNK_SIZE字节一段，线程池里的线程各自用pread读一段统计
+//输入文件不是普通文件（比如管道）或者读失败的时候返回false，调用者用collect_word_list一个字节一个字节地读
+bool collect_word_list_parallel(const char *filename,int threads,TokenList &tokens){
+	int fd=open(filename,O_RDONLY);
+	if(fd<0){
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode)){
+		close(fd);
+		return false;
+	}
+	HistogramBatch batch;
+	batch.data=0;
+	batch.fd=fd;
+	batch.size=st.st_size;
+	bool r=run_histogram_batch(batch,threads,tokens);
+	close(fd);
+	return r;
+}
+
+//多线程统计映射到内存里的输入的词汇表，和collect_word_list_parallel一样分段统计，只是不用pread
+//chunk_counts不是空的时候把每段的计数交给调用者，第i段（从i*HISTOGRAM_CHUNK_SIZE开始）在i*256开始的256个数里
+TokenList count_word_list_parallel(const unsigned char *data,size_t n,int threads,vector<long> *chunk_counts){
+	HistogramBatch batch;
+	batch.data=data;
+	batch.fd=-1;
+	batch.size=n;
+	TokenList tokens;
+	run_histogram_batch(batch,threads,tokens);
+	if(chunk_counts!=0){
+		chunk_counts->swap(batch.counts);
+	}
+	return tokens;
+}
+
+//每段编码以后的比特数：这一段里每个单词的次数乘编码长度加起来，counts是count_word_list_parallel给出的每段的计数
+//编码之前就能知道每段的编码从压缩内容的第几个比特开始，最后一项是总的比特数
+vector<uint64_t> encoded_chunk_starts(const vector<long> &counts,const HuffmanCodes &hcs){
+	size_t chunks=counts.size()/256;
+	vector<uint64_t> starts(chunks+1,0);
+	for(size_t i=0;i<chunks;++i){
+		uint64_t bits=0;
+		for(int b=0;b<256;++b){
+			bits+=static_cast<uint64_t>(counts[i*256+b])*hcs[b].len;
+		}
+		starts[i+1]=starts[i]+bits;
+	}
+	return starts;
+}
+
+//快速模式采样的字节数，以及普通文件每次采样的一页的字节数
+#define FAST_SAMPLE_SIZE (4L<<20)
+#define FAST_SAMPLE_PAGE 4096
+
+//快速模式：只用一部分输入估计词汇表，这样输入只要读一遍，边读边编码
+//输入是普通文件的时候，从整个文件里每隔几页用pread读一页，一共读FAST_SAMPLE_SIZE字节左右，in的位置不变
+//管道之类的输入读开头的FAST_SAMPLE_SIZE字节，放在prefix里，编码的时候要先编码它们
+//采样里没出现的单词权重是1，256个单词都有编码，没采到的单词出现了也能编码
+bool sample_word_list(istream &in,const char *filename,TokenList &tokens,vector<char> &prefix){
+	long counts[256]={0};
+	prefix.clear();
+	int fd=open(filename,O_RDONLY);
+	struct stat st;
+	if(fd>=0 && fstat(fd,&st)==0 && S_ISREG(st.st_mode)){
+		long pages=(st.st_size+FAST_SAMPLE_PAGE-1)/FAST_SAMPLE_PAGE;
+		long step=max(1L,pages/(FAST_SAMPLE_SIZE/FAST_SAMPLE_PAGE));//每隔step页采样一页
+		vector<unsigned char> page(FAST_SAMPLE_PAGE);
+		for(long i=0;i<pages;i+=step){
+			ssize_t n=pread(fd,&page[0],FAST_SAMPLE_PAGE,i*FAST_SAMPLE_PAGE);
+			if(n<0){
+				close(fd);
+				return false;
+			}
+			histogram_count(&page[0],n,counts);
+		}
+	}else{
+		prefix.resize(FAST_SAMPLE_SIZE);
+		in.read(&prefix[0],prefix.size());
+		if(in.bad()){
+			if(fd>=0){
+				close(fd);
+			}
+			return false;
+		}
+		prefix.resize(in.gcount());
+		if(!prefix.empty()){
+			histogram_count(reinterpret_cast<const unsigned char*>(&prefix[0]),prefix.size(),counts);
+		}
+		in.clear();
+	}
+	if(fd>=0){
+		close(fd);
+	}
+	tokens.clear();
+	for(int i=0;i<256;++i){
+		HuffmanToken token={static_cast<unsigned char>(i),max(counts[i],1L)};
+		tokens.push_back(token);
+	}
+	return true;
+}
+
+//快速模式编码时用的输入：先给出采样时读进内存的开头部分，再接着从原来的输入里读
+//counts不是空的时候，顺便统计读过的每个字节，用来算和两遍扫描相比压缩率差了多少
+class SampledSource : public ByteSource
+{
+public:
+	SampledSource(ByteSource &source,const vector<char> &prefix,long *counts)
+		:source_(source),prefix_(prefix),prefix_pos_(0),counts_(counts)
+	{
+	}
+
+protected:
+	virtual size_t fill(unsigned char *buf,size_t size){
+		size_t n=0;
+		if(prefix_pos_<prefix_.size()){
+			n=min(size,prefix_.size()-prefix_pos_);
+			memcpy(buf,&prefix_[prefix_pos_],n);
+			prefix_pos_+=n;
+		}else{
+			const unsigned char *p=source_.next(size,n);
+			if(n>0){
+				memcpy(buf,p,n);
+			}
+			failed_=source_.failed();
+		}
+		if(counts_!=0 && n>0){
+			histogram_count(buf,n,counts_);
+		}
+		return n;
+	}
+
+private:
+	ByteSource &source_;
+	const vector<char> &prefix_;
+	size_t prefix_pos_;//开头部分已经给出了多少字节
+	long *counts_;
+};
+
 //用词汇表的权重初始化huffman树（其实是森林，最后才合并成树）
 void init_huffman_tree(HuffmanTree &ht,const TokenList &tokens){
 	HuffmanNode default_node={-1,-1,-1,0};//初始每个节点的左右孩子和父亲下标都是-1，权重是0
@@ -89,105 +489,305 @@ void init_huffman_tree(HuffmanTree &ht,const TokenList &tokens){
 	return;
 }
 
-//寻找huffman树（其实是森林，最后才合并成树）中权重最小和次小的根节点
-void find_min_weight_positions(const HuffmanTree &ht,long end,long &min_pos1,long &min_pos2){
-	long min_weight1,min_weight2;//最小的和次小的节点权重
-	min_weight1=min_weight2=numeric_limits<long>::max();//初始化权重为long型的最大值
-	long i;
-	for(i=0;i<end;++i){
-		if(ht[i].parent!=-1){//parent=-1的才是根节点，其他的忽略
-			continue;
-		}
-		if(ht[i].weight<=min_weight1){//这里判断关系时，必须写成小于等于，如果只写成小于，那么存在两个同weight而pos不同的元素时，就会漏掉其中一个
-			min_weight2=min_weight1;//如果当前节点比已找到的最小值还小，那么最小值就要变成当前节点，原来的最小值变为次小值
-			min_pos2=min_pos1;
-			min_weight1=ht[i].weight;
-			min_pos1=i;
-		}else if(ht[i].weight<min_weight2){//如果当前节点比次小值小，那么就记录新的次小值
-			min_weight2=ht[i].weight;
-			min_pos2=i;
+//创建huffman树
+//叶子按权重排好序以后，用两个队列（排好序的叶子、按合并顺序排列的中间节点）线性时间地合并，见HuffmanBuilder.h
+//原来每次合并都扫描一遍所有的根找最小的两个，单词多的时候是O(n^2)
+void create_huffman_tree(HuffmanTree &ht,const TokenList &tokens){
+	init_huffman_tree(ht,tokens);//用词汇表的全部n个项目的权重初始化树（其实是森林）
+	two_queue_huffman_tree(ht,tokens.size());//做n-1次合并，合并后的节点存在n到2*n-2
+	//ht[hi.size()-1]中的节点就是huffman树的根，0到n-1是叶子节点，剩下的是中间节点
+	return;
+}
+
+//package-merge算法里的一个项目，要么是一个叶子（单词），要么是上一层两个项目打成的包
+struct PackageMergeItem{
+	long weight;//权重，包的权重是两个项目权重的和
+	long leaf;//叶子对应的词汇表下标，是包的时候为-1
+	long left,right;//是包的时候，打包的两个项目在上一层列表里的下标
+};
+
+typedef vector<PackageMergeItem> PackageMergeList;
+
+//按权重比较两个项目，权重相同的时候叶子排在包前面
+bool package_merge_less(const PackageMergeItem &a,const PackageMergeItem &b){
+	if(a.weight!=b.weight){
+		return a.weight<b.weight;
+	}
+	return a.leaf>=0 && b.leaf<0;
+}
+
+//从第level层列表的第i个项目开始往下数，每遇到一个叶子，这个单词的编码长度就加1
+void count_package_merge_item(const vector<PackageMergeList> &levels,long level,long i,vector<int> &len_of_token){
+	const PackageMergeItem &item=levels[level][i];
+	if(item.leaf>=0){
+		++len_of_token[item.leaf];
+	}else{
+		count_package_merge_item(levels,level-1,item.left,len_of_token);
+		count_package_merge_item(levels,level-1,item.right,len_of_token);
+	}
+}
+
+//用package-merge算法求出编码长度不超过max_len的最优编码长度
+//把所有叶子按权重排好序作为第一层，之后每一层把上一层相邻的两个项目打成包，再和全部叶子按权重合并
+//一共做max_len层，最后一层中权重最小的2n-2个项目里，每个单词作为叶子出现几次，它的编码长度就是几
+//如果2^max_len比单词数还少，不可能有这样的编码，返回false
+bool create_limited_code_lengths(const TokenList &tokens,int max_len,HuffmanCodeLengths &lengths){
+	long n=tokens.size();
+	lengths.assign(256,0);
+	if(n==0 || max_len<1 || (max_len<63 && (1L<<max_len)<n)){
+		return false;
+	}
+	if(n==1){//只有一个单词的时候编码长度定为1，和create_huffman_code_lengths一样
+		lengths[tokens[0].byte]=1;
+		return true;
+	}
+
+	PackageMergeList leaves;
+	for(long i=0;i<n;++i){
+		PackageMergeItem item={tokens[i].weight,i,-1,-1};
+		leaves.push_back(item);
+	}
+	stable_sort(leaves.begin(),leaves.end(),package_merge_less);
+
+	vector<PackageMergeList> levels(max_len);
+	levels[0]=leaves;
+	for(int level=1;level<max_len;++level){
+		const PackageMergeList &prev=levels[level-1];
+		PackageMergeList packages;
+		for(long i=0;i+1<static_cast<long>(prev.size());i+=2){//相邻两个项目打成一个包
+			PackageMergeItem item={prev[i].weight+prev[i+1].weight,-1,i,i+1};
+			packages.push_back(item);
 		}
+		levels[level].resize(leaves.size()+packages.size());
+		merge(leaves.begin(),leaves.end(),packages.begin(),packages.end(),levels[level].begin(),package_merge_less);
 	}
-	return;
+
+	vector<int> len_of_token(n,0);
+	for(long i=0;i<2*n-2;++i){
+		count_package_merge_item(levels,max_len-1,i,len_of_token);
+	}
+	for(long i=0;i<n;++i){
+		lengths[tokens[i].byte]=len_of_token[i];
+	}
+	return true;
 }
 
-//创建huffman树
-void create_huffman_tree(HuffmanTree &ht,const TokenList &tokens){
-	init_huffman_tree(ht,tokens);//用词汇表的全部n个项目的权重初始化树（其实是森林）
+//按编码长度算出编码后一共有多少比特，用来比较限制编码长度损失了多少压缩率
+long encoded_bit_count(const TokenList &tokens,const HuffmanCodeLengths &lengths){
+	long bits=0;
+	TokenList::size_type wordcount=tokens.size();
+	for(TokenList::size_type i=0; i<wordcount; ++i){
+		bits+=tokens[i].weight*lengths[tokens[i].byte];
+	}
+	return bits;
+}
 
-	//现在0到n-1个节点的权重是词汇表中的权重值
-	//从n到2*n-2做共n-1次合并，每次找到最小和次小的根的权重，合并根和权重，合并后的节点存储下来
-	HuffmanTree::size_type nodecount=ht.size();
-	for(TokenList::size_type i=tokens.size(); i<nodecount; ++i){
-		long min_pos1=-1,min_pos2=-1;//最小值和次小值
-		find_min_weight_positions(ht,i,min_pos1,min_pos2);//找到权重最小和次小的两个根
-		ht[min_pos1].parent=ht[min_pos2].parent=i;//这两个根变为当前节点的子节点
-		ht[i].lchild=min_pos1;//一个作为当前的左孩子
-		ht[i].rchild=min_pos2;//另一个作为当前节点的右孩子
-		ht[i].weight=ht[min_pos1].weight+ht[min_pos2].weight;//当前节点的权重为两个子节点权重的和
-	}
-	//循环结束后ht[hi.size()-1]中的节点就是huffman树的根，0到n-1是叶子节点，剩下的是中间节点
-	return;
+//存储：256个单词的编码长度都是8，按范式huffman编码的规则每个单词的编码就是它自己的值，压缩内容就是原来的字节
+//存储的文件和块还是合法的第2版、第4版格式，老版本的程序也能照常解码，新版本认出来以后直接复制，不用解码
+bool stored_code_lengths(const HuffmanCodeLengths &lengths){
+	return lengths.size()==256 && count(lengths.begin(),lengths.end(),8)==256;
+}
+
+//编码表是不是存储用的，每个单词的编码就是它自己
+bool stored_codes(const HuffmanCodes &hcs){
+	for(size_t i=0;i<hcs.size();++i){
+		if(hcs[i].len!=8 || hcs[i].code!=i){
+			return false;
+		}
+	}
+	return hcs.size()==256;
+}
+
+//在编码之前从词汇表估计压缩以后能小多少，小不了STORED_MIN_GAIN_PERCENT的时候返回true，调用者改成存储
+//比如已经压缩过的文件、图片、视频，单词的次数差不多一样，huffman编码以后几乎和原来一样大，编码一遍只是浪费时间
+//limit是限制的编码长度，限制在8比特以内的时候不能存储
+bool should_store(const TokenList &tokens,const HuffmanCodeLengths &lengths,int limit,double *gain){
+	long raw_bits=0;
+	for(size_t i=0;i<tokens.size();++i){
+		raw_bits+=tokens[i].weight*8;
+	}
+	long bits=encoded_bit_count(tokens,lengths);
+	if(gain!=0){
+		*gain=(raw_bits>0 ? (raw_bits-bits)*100.0/raw_bits : 0);
+	}
+	return (limit==0 || limit>=8) && raw_bits>0 && (raw_bits-bits)*100.0<raw_bits*static_cast<double>(STORED_MIN_GAIN_PERCENT);
 }
 
 //通过huffman树，创建某个单词的huffman编码
-void create_huffman_code(const HuffmanTree &ht,long ht_index,unsigned char byte,HuffmanCode &hc){
+void create_huffman_code(const HuffmanTree &ht,long ht_index,HuffmanCode &hc){
 	long i=ht_index;//我们要创建编码的单词在huffman树中的下标
-	hc.byte=byte;//记录我们要创建编码的单词
+	uint64_t code=0;
+	int len=0;
 
 	//从huffman树的叶子节点开始往父节点走
 	//如果当前节点是父节点的左孩子，那么编码为0，是右孩子，编码为1
-	//就这样走到根节点后，求得了一连串编码，然后把它反转过来，就是需要的huffman编码
+	//从叶子往根走，先得到的是编码的最后一个比特，所以第len步得到的比特放在编码的第len位，走到根的时候编码就是正的，不用再反转
 	while(ht[i].parent!=-1){//根节点的parent都是-1，如果还没走到根节点，就继续走
-		if(ht[ht[i].parent].lchild==i){//如果当前节点是父节点的左孩子
-			hc.code.push_back(0);//新增加编码0
-		}else{//如果当前节点是父节点的右孩子
-			hc.code.push_back(1);//新增加编码1
+		if(ht[ht[i].parent].rchild==i){//如果当前节点是父节点的右孩子，这一位是1，左孩子是0
+			code|=static_cast<uint64_t>(1)<<len;
 		}
+		++len;
 		i=ht[i].parent;//往根节点走一步
 	}
-	reverse(hc.code.begin(),hc.code.end());//反转刚才得到的编码，才是我们要求的结果
-	//reverse是标准库的算法
+	hc.code=code;
+	hc.len=len;
 	return;
 }
 
 //通过huffman树，为所有单词创建编码
 void create_huffman_codes(const HuffmanTree &ht, const TokenList &tokens, HuffmanCodes &hcs){
-	hcs.clear();
-	//huffman编码集合初始化
-	for(int i=0;i<256;++i){//总共有256种可能的单词
-		HuffmanCode hc;hc.byte=i;
-		hcs.push_back(hc);
-	}
+	HuffmanCode empty_code={0,0};
+	hcs.assign(256,empty_code);//huffman编码集合初始化，总共有256种可能的单词
 
 	//对每个在词汇表中的单词创建编码，不在词汇表中的单词就不管了
 	TokenList::size_type wordcount=tokens.size();
 	for(TokenList::size_type i=0; i<wordcount; ++i){
-		HuffmanCode hc;
-		unsigned char byte=tokens[i].byte;
-		create_huffman_code(ht,i,byte,hc);//为词汇表的第i项创建编码
-		hcs[byte].code=hc.code;//将创建好的编码存放到huffman编码集合中覆盖原来的默认值
+		create_huffman_code(ht,i,hcs[tokens[i].byte]);//为词汇表的第i项创建编码，直接存放到huffman编码集合中
 	}
 
 	//循环结束后，huffman编码集合hcs中包含256个元素，其中在词汇表中出现过的单词已经创建了编码
 	//没有在词汇表中出现的单词就没有创建
-	//要求假设字节（单词）的值为100，那么其对应编码就是hcs[100].code
+	//要求假设字节（单词）的值为100，那么其对应编码就是hcs[100]
+}
+
+//通过huffman树求出每个单词的编码长度，也就是叶子节点的深度
+//如果词汇表只有一项，huffman树只有一个节点，深度是0，这时把编码长度定为1，让这个单词也有编码可写
+void create_huffman_code_lengths(const HuffmanTree &ht,const TokenList &tokens,HuffmanCodeLengths &lengths){
+	lengths.assign(256,0);
+	TokenList::size_type wordcount=tokens.size();
+	for(TokenList::size_type i=0; i<wordcount; ++i){
+		int len=0;
+		for(long pos=i; ht[pos].parent!=-1; pos=ht[pos].parent){//从叶子往根走，走了几步就是编码长度
+			++len;
+		}
+		lengths[tokens[i].byte]=(len==0 ? 1 : len);
+	}
+}
+
+//按范式huffman编码的规则，求出每种编码长度的第一个编码
+//编码长度短的排在前面，长度相同的按单词的值排，同样长度的编码是连续的整数
+//这样只要知道每个单词的编码长度，压缩和解压缩两边就能得到一模一样的编码
+//如果编码长度超过MAX_CODE_LENGTH，或者不满足Kraft不等式（不可能来自一棵二叉树），就返回false
+bool create_canonical_first_codes(const HuffmanCodeLengths &lengths,vector<unsigned long long> &first_code){
+	int max_len=*max_element(lengths.begin(),lengths.end());
+	if(max_len>MAX_CODE_LENGTH){
+		return false;
+	}
+	vector<long> len_count(max_len+1,0);//每种编码长度的单词数，len_count[0]始终是0
+	for(int i=0;i<256;++i){
+		if(lengths[i]>0){
+			++len_count[lengths[i]];
+		}
+	}
+	first_code.assign(max_len+1,0);
+	unsigned long long code=0;
+	for(int len=1;len<=max_len;++len){
+		code=(code+len_count[len-1])<<1;//上一种长度的编码用完以后，下一个编码后面补一个0
+		first_code[len]=code;
+		if(code+len_count[len]>(1ULL<<len)){//这个长度的编码不够分了
+			return false;
+		}
+	}
+	return true;
+}
+
+//按范式huffman编码的规则，从编码长度创建编码表
+bool create_canonical_codes(const HuffmanCodeLengths &lengths,HuffmanCodes &hcs){
+	vector<unsigned long long> next_code;
+	if(create_canonical_first_codes(lengths,next_code)==false){
+		return false;
+	}
+	HuffmanCode empty_code={0,0};
+	hcs.assign(256,empty_code);
+	for(int i=0;i<256;++i){//单词按值从小到大，同样长度的编码也就按单词的值从小到大分配
+		int len=lengths[i];
+		if(len>0){
+			hcs[i].code=next_code[len]++;
+			hcs[i].len=len;
+		}
+	}
+	return true;
+}
+
+//按范式huffman编码的规则，从编码长度重建huffman树和词汇表，这样解压缩的时候和第1版格式一样用huffman树建解码表
+//0到n-1是叶子节点，和词汇表一一对应，最后一个节点是根，词汇表的权重不知道，都设为0
+//如果只有一个单词，树只有根和一个叶子，根的右孩子是-1
+bool create_canonical_tree(const HuffmanCodeLengths &lengths,HuffmanTree &ht,TokenList &tokens){
+	vector<unsigned long long> next_code;
+	if(create_canonical_first_codes(lengths,next_code)==false){
+		return false;
+	}
+	tokens.clear();
+	for(int i=0;i<256;++i){
+		if(lengths[i]>0){
+			HuffmanToken token={static_cast<unsigned char>(i),0};
+			tokens.push_back(token);
+		}
+	}
+	long n=tokens.size();
+	if(n==0){
+		return false;
+	}
+
+	//先把中间节点放在inner里，inner[0]是根，最后再把它们倒过来接到叶子后面，让根成为最后一个节点
+	HuffmanNode default_node={-1,-1,-1,0};
+	HuffmanTree inner(1,default_node);
+	ht.assign(n,default_node);
+	for(long i=0;i<n;++i){
+		int len=lengths[tokens[i].byte];
+		unsigned long long code=next_code[len]++;
+		long pos=0;//当前在inner里的位置
+		for(int bit=len-1;bit>0;--bit){//除了最后一个比特，沿着编码往下走，没有路就新建中间节点
+			long child=((code>>bit)&1) ? inner[pos].rchild : inner[pos].lchild;
+			if(child==-1){
+				child=-static_cast<long>(inner.size())-2;//中间节点先用负数编号，和叶子区分开
+				(((code>>bit)&1) ? inner[pos].rchild : inner[pos].lchild)=child;
+				inner.push_back(default_node);
+			}else if(child>=0){//路上遇到了叶子，说明编码不是前缀码
+				return false;
+			}
+			pos=-child-2;
+		}
+		long &leaf=(code&1) ? inner[pos].rchild : inner[pos].lchild;
+		if(leaf!=-1){//这个位置已经有别的节点了
+			return false;
+		}
+		leaf=i;
+	}
+
+	//把中间节点的负数编号换成真正的下标
+	long inner_n=inner.size();
+	ht.resize(n+inner_n,default_node);
+	for(long k=0;k<inner_n;++k){
+		long pos=n+inner_n-1-k;
+		long children[2]={inner[k].lchild,inner[k].rchild};
+		for(int c=0;c<2;++c){
+			if(children[c]<-1){
+				children[c]=n+inner_n-1-(-children[c]-2);
+			}
+			if(children[c]!=-1){
+				ht[children[c]].parent=pos;
+			}
+		}
+		ht[pos].lchild=children[0];
+		ht[pos].rchild=children[1];
+	}
+	return true;
 }
 
 //将我们创建的huffman编码集合的某一项的编码打印出来
-void print_huffman_code(const HuffmanCode &hc,const TokenList &tk,long &tk_i){
-	if(hc.code.size()==0){//没在词汇表中的单词是没有编码的，不打印，直接返回
+void print_huffman_code(const HuffmanCode &hc,unsigned char byte,const TokenList &tk,long &tk_i){
+	if(hc.len==0){//没在词汇表中的单词是没有编码的，不打印，直接返回
 		return;
 	}
-	if(isgraph(hc.byte)){
-		cout<<"'"<<hc.byte<<"'";
+	if(isgraph(byte)){
+		cout<<"'"<<byte<<"'";
 	}else{
-		cout<<"0x"<<hex<< static_cast<int>(hc.byte)<<dec;
+		cout<<"0x"<<hex<< static_cast<int>(byte)<<dec;
 	}
 	cout<<"\tweight "<<tk[tk_i].weight<<"\tcode:";
-	vector<int>::const_iterator iter, iter_end;
-	for(iter=hc.code.begin(), iter_end=hc.code.end(); iter!=iter_end; ++iter){
-		cout<<" "<<(*iter);
+	for(int bit=hc.len-1;bit>=0;--bit){//从编码的第一个比特（最高位）开始打印
+		cout<<" "<<((hc.code>>bit)&1);
 	}
 	++tk_i;
 	cout<<endl;
@@ -196,9 +796,8 @@ void print_huffman_code(const HuffmanCode &hc,const TokenList &tk,long &tk_i){
 //打印我们创建的huffman编码
 void print_huffman_codes(const HuffmanCodes &hcs,const TokenList &tk){
 	long tk_i=0;
-	HuffmanCodes::const_iterator iter, iter_end;
-	for(iter=hcs.begin(), iter_end=hcs.end(); iter!=iter_end; ++iter){//遍历编码集合
-		print_huffman_code((*iter),tk,tk_i);//打印每一项
+	for(int i=0;i<256;++i){//遍历编码集合
+		print_huffman_code(hcs[i],i,tk,tk_i);//打印每一项
 	}
 }
 
@@ -305,9 +904,30 @@ bool read_huffman_tree(istream &in,HuffmanTree &ht,TokenList &tokens)
 	return true;
 }
 
-//将标志头写到压缩文件里去
-bool write_huffman_zip_header(ostream &out){
-	out<<MAGIC_VERSION<<"\n";
+//按第2版格式把每个单词的编码长度输出到文件中
+//先用8比特写最大编码长度L，再用256个比特标记每个单词是否出现过，然后每个出现过的单词用width(L)个比特写它的编码长度
+//最后补齐到整字节，256个单词都出现的时候也只有161个字节
+bool write_huffman_code_lengths(ostream &out,const HuffmanCodeLengths &lengths){
+	int max_len=*max_element(lengths.begin(),lengths.end());
+	if(max_len>255){
+		return false;
+	}
+	int len_width=Bitstream::width(max_len);
+	try{
+		Bitstream::Out<long> bout(out);
+		bout.fixed(max_len,8);
+		for(int i=0;i<256;++i){
+			bout.boolean(lengths[i]>0);
+		}
+		for(int i=0;i<256;++i){
+			if(lengths[i]>0){
+				bout.fixed(lengths[i],len_width);
+			}
+		}
+		bout.flush();
+	}catch(const string &){
+		return false;
+	}
 	if(out){
 		return true;
 	}else{
@@ -315,53 +935,49 @@ bool write_huffman_zip_header(ostream &out){
 	}
 }
 
-//从压缩文件里读取第一行作为标志头
-string read_huffman_zip_header(istream &in){
-	string header;
-	getline(in,header);
-	return header;
-}
-
-//将编码过的内容写到文件里去
-void write_huffman_code(Bitstream::Out<long> &bout, const vector<int> &code){
-	vector<int>::const_iterator iter, iter_end;
-	for(iter=code.begin(), iter_end=code.end(); iter!=iter_end; ++iter){
-		bout.boolean((*iter)==1);//把编码的每个项目写到比特流里
-	}
-	//关于bout.boolean：如果bout.boolean(true)，会写比特'1'到文件里，如果是bout.boolean(false)，就写'0'到文件里。
-	return;
-}
-
-//通过为输入文件创建huffman的编码，并把编码后的内容写到输出文件
-bool huffman_data_encode(istream &in,ostream &out,const HuffmanCodes &hcs)
-{
-	long write_start_pos=out.tellp();//我们需要记录一开始写输出文件的位置，等下要跳回来
-	long bit_count=0;//记录一共写了多少个比特
-	//要在文件中记录一共写了多少个比特，但是这个值要写完整个文件才知道
-	//所以我们要为这个值在文件中预留一个位置，写完整个文件后再跳回来把实际写了多少个比特写到文件中
-	out.write(reinterpret_cast<const char*>(&bit_count),sizeof(bit_count));
-	if(!out){
-		return false;
-	}
-	
-	Bitstream::Out<long> bout(out);//创建比特流输出对象
-	bit_count=bout.position();
-	while(in){
-		unsigned char byte=0;
-		if(!in.read(reinterpret_cast<char*>(&byte),sizeof(byte))){//从输入文件中读一个单词
-			break;
-		}
-		write_huffman_code(bout,hcs[byte].code);//把此单词对应的编码写到输出文件中
-		if(!out){
+//按第2版格式从文件中读取每个单词的编码长度
+bool read_huffman_code_lengths(istream &in,HuffmanCodeLengths &lengths){
+	lengths.assign(256,0);
+	try{
+		Bitstream::In<long> bin(in);
+		int max_len=0;
+		bin.fixed(max_len,8);
+		if(max_len==0){
 			return false;
 		}
+		int len_width=Bitstream::width(max_len);
+		vector<bool> present(256,false);
+		for(int i=0;i<256;++i){
+			bool b=false;
+			bin.boolean(b);
+			present[i]=b;
+		}
+		for(int i=0;i<256;++i){
+			if(present[i]){
+				bin.fixed(lengths[i],len_width);
+				if(lengths[i]==0 || lengths[i]>max_len){
+					return false;
+				}
+			}
+		}
+		bin.flush();
+	}catch(const string &){//Bitstream库读到文件尾的时候会抛出string异常
+		return false;
+	}
+	if(in){
+		return true;
+	}else{
+		return false;
 	}
+}
 
-	bit_count=bout.position()-bit_count;//看看我们写了多少个比特
-	bout.flush();//把缓存中的数据全部实际的写到文件中
-	out.seekp(write_start_pos,ios::beg);//跳回文件头部
-	out.write(reinterpret_cast<const char*>(&bit_count),sizeof(bit_count));//记录一下我们写了多少比特
-	out.seekp(0,ios::end);//跳到文件尾部，这个操作其实可以不做，因为等下我们就要关闭文件了，不再写了
+//按大端字节序写一个64比特的无符号数，第2版格式用它，和机器的字节序无关
+bool write_uint64(ostream &out,unsigned long long value){
+	unsigned char bytes[8];
+	for(int i=0;i<8;++i){
+		bytes[i]=static_cast<unsigned char>(value>>(56-8*i));
+	}
+	out.write(reinterpret_cast<const char*>(bytes),sizeof(bytes));
 	if(out){
 		return true;
 	}else{
@@ -369,122 +985,2034 @@ bool huffman_data_encode(istream &in,ostream &out,const HuffmanCodes &hcs)
 	}
 }
 
-//使用huffman树的原理进行压缩的函数
-bool huffman_zip(const char *in_filename,const char *out_filename)
-{
+//按大端字节序读一个64比特的无符号数
+bool read_uint64(istream &in,unsigned long long &value){
+	unsigned char bytes[8];
+	in.read(reinterpret_cast<char*>(bytes),sizeof(bytes));
+	if(!in){
+		return false;
+	}
+	value=0;
+	for(int i=0;i<8;++i){
+		value=(value<<8)|bytes[i];
+	}
+	return true;
+}
+
+//将标志头写到压缩文件里去
+bool write_huffman_zip_header(ostream &out,int format){
+	const char *magic[]={MAGIC_VERSION,MAGIC_VERSION_2,MAGIC_VERSION_3,MAGIC_VERSION_4};
+	out<<magic[format-1]<<"\n";
+	if(out){
+		return true;
+	}else{
+		return false;
+	}
+}
+
+//从压缩文件里读取第一行作为标志头
+string read_huffman_zip_header(istream &in){
+	string header;
+	getline(in,header);
+	return header;
+}
+
+//编码表的种类
+#define ENCODE_TABLE_AUTO 0//根据编码长度和文件大小自动选择
+#define ENCODE_TABLE_SINGLE 1//每次查表编码一个单词
+#define ENCODE_TABLE_PAIR 2//每次查表编码两个单词
+#define ENCODE_TABLE_SIMD 3//用AVX2指令一次编码8个单词，CPU不支持或者编码太长的时候退回到一次编码一个单词
+
+//双单词编码表的项目数，用连续两个单词（字节）拼成的16比特作下标
+#define ENCODE_PAIR_TABLE_SIZE 65536
+
+//编码表里最长的编码
+int max_code_length(const HuffmanCodes &hcs){
+	int max_len=0;
+	for(int i=0;i<256;++i){
+		max_len=max(max_len,static_cast<int>(hcs[i].len));
+	}
+	return max_len;
+}
+
+//从编码表创建双单词编码表，下标是(第一个单词<<8)|第二个单词，项目里是两个编码接起来的编码和总长度
+//两个编码加起来可能超过56比特，所以只有最长的编码不超过MAX_CODE_LENGTH的一半时才能创建，否则返回false
+bool create_pair_encode_table(const HuffmanCodes &hcs,HuffmanCodes &pairs){
+	if(max_code_length(hcs)*2>MAX_CODE_LENGTH){
+		return false;
+	}
+	HuffmanCode empty_code={0,0};
+	pairs.assign(ENCODE_PAIR_TABLE_SIZE,empty_code);
+	for(int first=0;first<256;++first){
+		if(hcs[first].len==0){//没出现过的单词不会在输入文件里遇到，不用填
+			continue;
+		}
+		for(int second=0;second<256;++second){
+			if(hcs[second].len==0){
+				continue;
+			}
+			HuffmanCode &hc=pairs[(first<<8)|second];
+			hc.code=(static_cast<uint64_t>(hcs[first].code)<<hcs[second].len)|hcs[second].code;
+			hc.len=hcs[first].len+hcs[second].len;
+		}
+	}
+	return true;
+}
+
+//选择编码表的种类
+//CPU支持AVX2并且编码都不超过32比特的时候用AVX2一次编码8个单词
+//双单词编码表有512KB，创建它要填65536个项目，文件比表还小的时候不划算；编码太长放不下两个的时候也不能用
+int choose_encode_table(const HuffmanCodes &hcs,const TokenList &tokens){
+	if(simd_encode_supported(max_code_length(hcs))){
+		return ENCODE_TABLE_SIMD;
+	}
+	long total=0;//文件里一共有多少个单词
+	for(TokenList::size_type i=0;i<tokens.size();++i){
+		total+=tokens[i].weight;
+	}
+	if(total<ENCODE_PAIR_TABLE_SIZE){
+		return ENCODE_TABLE_SINGLE;
+	}
+	if(max_code_length(hcs)*2>MAX_CODE_LENGTH){
+		return ENCODE_TABLE_SINGLE;
+	}
+	return ENCODE_TABLE_PAIR;
+}
+
+//编码用到的几种表，由init_huffman_encoder按编码表的种类准备好，encode_huffman_bytes用它们编码一段单词
+struct HuffmanEncoder{
+	HuffmanCodes codes;//一次编码一个单词的编码表
+	HuffmanCodes pairs;//双单词编码表，空的表示不用
+	uint64_t packed[256];//AVX2编码用的编码表，低56比特是编码，高8比特是编码长度
+	int max_len;//最长的编码
+	bool use_simd;//是否用AVX2编码
+};
+
+//按编码表的种类准备编码用的表，编码太长或者CPU不支持的时候退回到一次编码一个单词
+void init_huffman_encoder(HuffmanEncoder &enc,const HuffmanCodes &hcs,int encode_table){
+	enc.codes=hcs;
+	enc.pairs.clear();
+	if(encode_table==ENCODE_TABLE_PAIR && create_pair_encode_table(hcs,enc.pairs)==false){
+		enc.pairs.clear();
+	}
+	enc.max_len=max_code_length(hcs);
+	enc.use_simd=(encode_table==ENCODE_TABLE_SIMD && simd_encode_supported(enc.max_len));
+	for(int i=0;i<256;++i){
+		enc.packed[i]=hcs[i].code|(static_cast<uint64_t>(hcs[i].len)<<56);
+	}
+}
+
+//把p开始的n个单词编码写到bw里，bw里要有足够放下这些编码的空间
+void encode_huffman_bytes(const HuffmanEncoder &enc,const unsigned char *p,size_t n,BitWriter &bw){
+	size_t i=0;
+	if(enc.use_simd){//8个单词8个单词地编码，剩下不满8个的在后面一个一个编码
+		i=simd_encode(enc.packed,p,n,enc.max_len,bw);
+	}else if(!enc.pairs.empty()){//两个单词两个单词地编码，最后可能剩下一个单词
+		for(;i+1<n;i+=2){
+			const HuffmanCode &hc=enc.pairs[(p[i]<<8)|p[i+1]];//查一次表得到两个单词的编码
+			bw.put(hc.code,hc.len);
+		}
+	}
+	for(;i<n;++i){
+		const HuffmanCode &hc=enc.codes[p[i]];//查一次编码表
+		bw.put(hc.code,hc.len);//把此单词对应的编码写到比特流中
+	}
+}
+
+//编码写完以后跳回write_start_pos，把预留的比特数改成实际写了的比特数
+bool write_huffman_bit_count(ostream &out,long write_start_pos,long bit_count,int format){
+	out.seekp(write_start_pos,ios::beg);//跳回文件头部
+	if(format==1){//记录一下我们写了多少比特
+		out.write(reinterpret_cast<const char*>(&bit_count),sizeof(bit_count));
+	}else{
+		write_uint64(out,bit_count);
+	}
+	out.seekp(0,ios::end);//跳到文件尾部，这个操作其实可以不做，因为等下我们就要关闭文件了，不再写了
+	if(out){
+		return true;
+	}else{
+		return false;
+	}
+}
+
+//多线程编码第1、2版格式时每个线程一次编码的字节数
+#define PARALLEL_ENCODE_CHUNK_SIZE (1L<<20)
+
+//多线程编码时的一段输入
+struct ChunkEncodeJob{
+	const unsigned char *data;//这段输入
+	size_t size;//这段的字节数
+	vector<unsigned char> output;//这段的编码，最后不满一个字节的部分用0补齐
+	uint64_t bit_count;//编码的比特数，不算补齐的比特
+};
+
+//一批要多线程编码的输入
+struct ChunkEncodeBatch{
+	vector<ChunkEncodeJob> jobs;
+	const HuffmanEncoder *enc;//所有线程共用的编码表，只读
+};
+
+//线程池里的任务：把第index段编码到它自己的缓冲区里
+void chunk_encode_task(void *arg,long index){
+	ChunkEncodeBatch *batch=static_cast<ChunkEncodeBatch*>(arg);
+	ChunkEncodeJob &job=batch->jobs[index];
+	//编码不会超过size*max_len比特，BitWriter每次存8个字节，最后再补齐一次，多留16个字节
+	job.output.resize(job.size/8*batch->enc->max_len+batch->enc->max_len+16);
+	BitWriter bw(&job.output[0],&job.output[0]+job.output.size());
+	encode_huffman_bytes(*batch->enc,job.data,job.size,bw);
+	job.bit_count=bw.position();
+	bw.flush();
+	job.output.resize(bw.size());
+}
+
+//把一段编码的前bit_count个比特接到bw后面，bw里的比特数不一定是8的倍数
+//每次取编码里的8个字节，按大端字节序当成64比特的编码写到bw里，BitWriter::put会把它移到bw当前的比特位置再OR进去
+//bw里要有足够放下这些比特的空间
+void append_encoded_bits(BitWriter &bw,const unsigned char *bits,uint64_t bit_count){
+	size_t words=bit_count/64;
+	for(size_t i=0;i<words;++i){
+		uint64_t value;
+		memcpy(&value,bits+i*8,8);
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+		value=__builtin_bswap64(value);
+#else
+		const unsigned char *p=reinterpret_cast<const unsigned char*>(&value);
+		value=0;
+		for(int k=0;k<8;++k){
+			value=(value<<8)|p[k];
+		}
+#endif
+		bw.put(value,64);
+	}
+	int rest=static_cast<int>(bit_count%64);
+	if(rest>0){//最后不满64比特的部分，字节数不一定够8个，一个一个读
+		uint64_t value=0;
+		const unsigned char *p=bits+words*8;
+		for(int k=0;k<(rest+7)/8;++k){
+			value|=static_cast<uint64_t>(p[k])<<(56-8*k);
+		}
+		bw.put(value>>(64-rest),rest);
+	}
+}
+
+//用线程池把data开始的n个字节分段编码，每段由一个线程编码到自己的缓冲区里，编完再按顺序把每段的比特接到bw后面
+//out不是空的时候，每接完一段就把bw里存好的字节写到out里，bw只要放得下一段的编码；out是空的时候bw要放得下所有的编码
+//一次只编码线程数两倍的段，内存里最多只有这么多段的编码
+//所有段用的是同一张编码表，接起来的比特流和一个线程从头编码到尾完全一样
+bool encode_chunks_parallel(ThreadPool &pool,const HuffmanEncoder &enc,const unsigned char *data,size_t n,BitWriter &bw,ByteSink *out)
+{
+	size_t wave_size=pool.size()*2*PARALLEL_ENCODE_CHUNK_SIZE;
+	ChunkEncodeBatch batch;
+	batch.enc=&enc;
+	for(size_t start=0;start<n;start+=wave_size){
+		size_t size=min(wave_size,n-start);
+		batch.jobs.assign((size+PARALLEL_ENCODE_CHUNK_SIZE-1)/PARALLEL_ENCODE_CHUNK_SIZE,ChunkEncodeJob());
+		for(size_t i=0;i<batch.jobs.size();++i){
+			batch.jobs[i].data=data+start+i*PARALLEL_ENCODE_CHUNK_SIZE;
+			batch.jobs[i].size=min(static_cast<size_t>(PARALLEL_ENCODE_CHUNK_SIZE),size-i*PARALLEL_ENCODE_CHUNK_SIZE);
+		}
+		pool.run(chunk_encode_task,&batch,batch.jobs.size());
+		for(size_t i=0;i<batch.jobs.size();++i){
+			append_encoded_bits(bw,&batch.jobs[i].output[0],batch.jobs[i].bit_count);
+			if(out!=0){
+				if(out->write(bw.data(),bw.size())==false){
+					return false;
+				}
+				bw.clear();
+			}
+		}
+	}
+	return true;
+}
+
+//多线程编码in里的内容，写到out里，bit_count返回一共写了多少比特（不算补齐的比特）
+//每次取线程数两倍的段，用encode_chunks_parallel编码，接起来写出去
+bool huffman_data_encode_parallel(ByteSource &in,ByteSink &out,const HuffmanEncoder &enc,int threads,long &bit_count)
+{
+	ThreadPool pool(threads);
+	size_t wave_size=pool.size()*2*PARALLEL_ENCODE_CHUNK_SIZE;
+	//接比特的缓冲区，放得下一段的编码
+	vector<unsigned char> outbuf(PARALLEL_ENCODE_CHUNK_SIZE/8*enc.max_len+enc.max_len+16);
+	BitWriter bw(&outbuf[0],&outbuf[0]+outbuf.size());
+	for(;;){
+		size_t n=0;
+		const unsigned char *data=in.next(wave_size,n);
+		if(n==0){
+			break;
+		}
+		if(encode_chunks_parallel(pool,enc,data,n,bw,&out)==false){
+			return false;
+		}
+	}
+	if(in.failed()){
+		return false;
+	}
+	bit_count=bw.position();
+	bw.flush();
+	return out.write(bw.data(),bw.size());
+}
+
+//一个线程编码in里的内容，写到out里，bit_count返回一共写了多少比特（不算补齐的比特）
+//一次从输入取一批单词，编码放到输出缓冲区里，一批编完再写到输出
+//每个编码最长MAX_CODE_LENGTH比特，所以输出缓冲区按每个单词8个字节准备，一批单词怎么编码都放得下
+bool huffman_data_encode_serial(ByteSource &in,ByteSink &out,const HuffmanEncoder &enc,long &bit_count)
+{
+	const size_t inbuf_size=65536;
+	vector<unsigned char> outbuf(inbuf_size*8+8);
+	BitWriter bw(&outbuf[0],&outbuf[0]+outbuf.size());//创建比特流输出对象
+	for(;;){
+		size_t n=0;
+		const unsigned char *data=in.next(inbuf_size,n);//从输入中取一批单词
+		if(n==0){
+			break;
+		}
+		encode_huffman_bytes(enc,data,n,bw);//批大小是偶数也是8的倍数，只有文件最后一批会剩下几个单词一个一个编码
+		if(out.write(bw.data(),bw.size())==false){
+			return false;
+		}
+		bw.clear();
+	}
+	if(in.failed()){
+		return false;
+	}
+
+	bit_count=bw.position();//看看我们写了多少个比特
+	bw.flush();//把剩下的不满64比特的内容也写到文件中
+	return out.write(bw.data(),bw.size());
+}
+
+//存储：把in里的内容原样复制到out，bit_count返回字节数乘8
+bool copy_stored_bytes(ByteSource &in,ByteSink &out,long &bit_count)
+{
+	long total=0;
+	for(;;){
+		size_t n=0;
+		const unsigned char *data=in.next(PARALLEL_ENCODE_CHUNK_SIZE,n);
+		if(n==0){
+			break;
+		}
+		if(out.write(data,n)==false){
+			return false;
+		}
+		total+=n;
+	}
+	bit_count=total*8;
+	return in.failed()==false;
+}
+
+//threads大于1的时候多线程编码，否则一个线程编码，编码表是存储用的时候直接复制
+bool huffman_data_encode_stream(ByteSource &in,ByteSink &out,const HuffmanEncoder &enc,int threads,long &bit_count)
+{
+	if(stored_codes(enc.codes)){//存储的时候压缩内容就是原来的字节，直接复制
+		return copy_stored_bytes(in,out,bit_count);
+	}
+	if(threads>1){
+		return huffman_data_encode_parallel(in,out,enc,threads,bit_count);
+	}
+	return huffman_data_encode_serial(in,out,enc,bit_count);
+}
+
+//用流水线编码：读线程从in读，这个线程编码，写线程往out写，每个阶段等了多久记到stats里
+//in是一块内存的时候不用读，也就不用读线程
+bool huffman_data_encode_pipelined(ByteSource &in,ByteSink &out,const HuffmanEncoder &enc,int threads,long &bit_count,PipelineStats &stats)
+{
+	ThreadedSink threaded_out(out,PIPELINE_BUFFERS,PIPELINE_BUFFER_SIZE);
+	bool r=false;
+	if(dynamic_cast<MemorySource*>(&in)!=0){
+		r=huffman_data_encode_stream(in,threaded_out,enc,threads,bit_count);
+	}else{
+		ThreadedSource threaded_in(in,PIPELINE_BUFFERS,PIPELINE_BUFFER_SIZE);
+		r=huffman_data_encode_stream(threaded_in,threaded_out,enc,threads,bit_count);
+		threaded_in.stop();
+		stats.read_wait=threaded_in.read_wait();
+		stats.input_wait=threaded_in.input_wait();
+	}
+	bool finished=threaded_out.finish();//出错的时候也要等写线程结束
+	r=(r && finished);
+	stats.output_wait=threaded_out.output_wait();
+	stats.write_wait=threaded_out.write_wait();
+	return r;
+}
+
+//把比特数按format的格式写到field里，返回占的字节数：第1版格式是long，第2版格式是大端字节序的64比特
+size_t format_bit_count(unsigned char *field,uint64_t bit_count,int format){
+	if(format==1){
+		long count=bit_count;
+		memcpy(field,&count,sizeof(count));
+		return sizeof(count);
+	}
+	for(int i=0;i<8;++i){
+		field[i]=static_cast<unsigned char>(bit_count>>(56-8*i));
+	}
+	return 8;
+}
+
+//多线程直接编码到输出里的一轮任务，每个任务编码统计词汇表时的一段（HISTOGRAM_CHUNK_SIZE字节）
+struct InPlaceEncodeBatch{
+	const HuffmanEncoder *enc;//所有线程共用的编码表，只读
+	const unsigned char *data;//输入
+	size_t size;//输入的字节数
+	unsigned char *payload;//压缩内容在输出里开始的位置
+	const vector<uint64_t> *starts;//每段的编码开始的比特位置，最后一项是总的比特数
+	int parity;//这一轮编码的是偶数段（0）还是奇数段（1）
+	vector<char> ok;//每段编码的比特数是否和事先算的一样
+};
+
+//线程池里的任务：把这一轮的第index段直接编码到它在输出里的位置上
+//段的第一个和最后一个字节可能和相邻的段共用，BitWriter会把不属于这一段的比特写成0，所以先记下这两个字节原来的值，编完再OR回去
+//相邻的两段不在同一轮里编码，不会同时写共用的字节
+void in_place_encode_task(void *arg,long index){
+	InPlaceEncodeBatch *batch=static_cast<InPlaceEncodeBatch*>(arg);
+	size_t chunk=index*2+batch->parity;
+	uint64_t start=(*batch->starts)[chunk], end=(*batch->starts)[chunk+1];
+	size_t offset=chunk*HISTOGRAM_CHUNK_SIZE;
+	size_t size=min(static_cast<size_t>(HISTOGRAM_CHUNK_SIZE),batch->size-offset);
+	if(end==start){//只有一个单词的时候编码长度是0，什么也不用写
+		batch->ok[chunk]=1;
+		return;
+	}
+	unsigned char *first=batch->payload+start/8;
+	unsigned char *last=batch->payload+(end-1)/8;
+	unsigned char first_byte=*first, last_byte=*last;
+	BitWriter bw(first,last+9,static_cast<int>(start%8));
+	encode_huffman_bytes(*batch->enc,batch->data+offset,size,bw);
+	batch->ok[chunk]=(bw.position()==end-start);
+	bw.flush();
+	*first|=first_byte;
+	*last|=last_byte;
+}
+
+//用线程池把data开始的n个字节直接编码到payload里，starts是encoded_chunk_starts事先算好的每段的位置
+//先编码所有的偶数段，再编码所有的奇数段，每段直接写到最终的位置上，没有中间缓冲区，也不用再把每段的比特接起来
+//payload最后要多留8个字节给BitWriter补齐，编出来的比特流和一个线程从头编码到尾完全一样
+bool encode_chunks_in_place(ThreadPool &pool,const HuffmanEncoder &enc,const unsigned char *data,size_t n,unsigned char *payload,const vector<uint64_t> &starts)
+{
+	size_t chunks=starts.size()-1;
+	InPlaceEncodeBatch batch;
+	batch.enc=&enc;
+	batch.data=data;
+	batch.size=n;
+	batch.payload=payload;
+	batch.starts=&starts;
+	batch.ok.assign(chunks,0);
+	for(batch.parity=0;batch.parity<2;++batch.parity){
+		pool.run(in_place_encode_task,&batch,(chunks+1-batch.parity)/2);
+	}
+	return find(batch.ok.begin(),batch.ok.end(),0)==batch.ok.end();
+}
+
+//输入映射到内存的时候，第1、2版格式直接编码到映射的输出文件里，data是映射的输入
+//词汇表是分段统计的，每段编码以后的比特数starts事先就能算出来（见encoded_chunk_starts），输出文件的大小也就知道了：
+//header（标志头和huffman树或编码长度）、比特数、压缩内容，先用fallocate给输出文件分配这么大的空间再映射，磁盘空间不够的时候在这里就失败，不会在写映射的时候收到SIGBUS
+//一个线程的时候BitWriter直接往映射里从头写到尾；多线程的时候每个线程把自己的段直接编码到映射里事先算好的位置上（encode_chunks_in_place）
+//不经过输出流的缓冲区，也不用跳回去改比特数，写出来的内容和huffman_data_encode完全一样
+bool huffman_mapped_encode(const unsigned char *data,size_t n,const string &header,const char *out_filename,const HuffmanCodes &hcs,
+		const vector<uint64_t> &starts,int format,int encode_table,int threads)
+{
+	uint64_t bit_count=starts.back();
+	HuffmanEncoder enc;
+	init_huffman_encoder(enc,hcs,encode_table);
+	size_t count_size=(format==1 ? sizeof(long) : 8);//第1版格式直接写long型的比特数
+	size_t size=header.size()+count_size+(bit_count+7)/8;
+	size_t map_size=size+16;//BitWriter每次存8个字节，最后补齐的时候也要8个字节的空间，先多留16个字节，写完再截掉
+	int fd=open(out_filename,O_RDWR|O_CREAT|O_TRUNC,0666);
+	if(fd<0){
+		return false;
+	}
+	void *p=MAP_FAILED;
+	int allocated=fallocate(fd,0,0,map_size);//文件系统不支持fallocate的时候只扩展文件大小
+	if(allocated==0 || ((errno==EOPNOTSUPP || errno==ENOSYS) && ftruncate(fd,map_size)==0)){
+		p=mmap(0,map_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	}
+	if(p==MAP_FAILED){
+		close(fd);
+		return false;
+	}
+	unsigned char *base=static_cast<unsigned char*>(p);
+	memcpy(base,header.data(),header.size());
+	unsigned char *count_field=base+header.size();
+	format_bit_count(count_field,bit_count,format);
+	bool r=true;
+	if(stored_codes(hcs)){//存储的时候压缩内容就是原来的字节
+		memcpy(count_field+count_size,data,n);
+	}else if(threads>1 && starts.size()>2){
+		ThreadPool pool(threads);
+		r=encode_chunks_in_place(pool,enc,data,n,count_field+count_size,starts);
+	}else{
+		BitWriter bw(count_field+count_size,base+map_size);
+		encode_huffman_bytes(enc,data,n,bw);
+		r=(bw.position()==bit_count);
+		bw.flush();
+	}
+	if(munmap(p,map_size)!=0 || ftruncate(fd,size)!=0){
+		r=false;
+	}
+	if(close(fd)!=0){
+		r=false;
+	}
+	return r;
+}
+
+//第1、2版格式用io_uring写输出文件：header（标志头和huffman树或编码长度）先用pwrite写，比特数先留空
+//压缩内容从比特数后面开始写到UringSink里，攒满一个缓冲区就提交一个写请求，编码不等写完成，最后再用pwrite把比特数写上
+//内核不支持io_uring的时候UringSink用pwrite同步写，写出来的内容都和huffman_data_encode完全一样
+bool huffman_uring_encode(ByteSource &in,const string &header,const char *out_filename,const HuffmanCodes &hcs,
+		int format,int encode_table,int threads,bool verbose)
+{
+	HuffmanEncoder enc;
+	init_huffman_encoder(enc,hcs,encode_table);
+	unsigned char count_field[8]={0};
+	size_t count_size=format_bit_count(count_field,0,format);
+	UringSink sink;
+	if(sink.open(out_filename,header.size()+count_size)==false){
+		return false;
+	}
+	if(verbose){
+		clog<<(sink.uring() ? "写输出用io_uring" : "io_uring不可用，写输出用pwrite")<<endl;
+	}
+	long bit_count=0;
+	bool r=uring_pwrite_full(sink.fd(),reinterpret_cast<const unsigned char*>(header.data()),header.size(),0);
+	r=(r && huffman_data_encode_stream(in,sink,enc,threads,bit_count));
+	r=(sink.finish() && r);//出错的时候也要等写请求都完成
+	if(r==false){
+		return false;
+	}
+	format_bit_count(count_field,bit_count,format);
+	return uring_pwrite_full(sink.fd(),count_field,count_size,header.size());
+}
+
+//通过为输入文件创建huffman的编码，并把编码后的内容写到输出文件
+//format是压缩文件格式的版本，第1版直接写long型的比特数，第2版按大端字节序写64比特的比特数
+//encode_table是ENCODE_TABLE_PAIR的时候一次查表编码两个单词，是ENCODE_TABLE_SIMD的时候用AVX2一次编码8个单词
+//编码太长或者CPU不支持的时候退回到一次编码一个单词，threads大于1的时候多线程编码，不管用哪种方法输出都完全一样
+//输入从in里一段一段地取，编码直接在取出来的连续内存上做；out要能移动文件指针，编完要跳回去写比特数
+//pipeline不是空的时候读输入和写输出各用一个线程，和编码同时进行，每个阶段等了多久记到pipeline里；输入是一块内存的时候不用读线程
+bool huffman_data_encode(ByteSource &in,ostream &out,const HuffmanCodes &hcs,int format,int encode_table,int threads,PipelineStats *pipeline)
+{
+	HuffmanEncoder enc;
+	init_huffman_encoder(enc,hcs,encode_table);
+
+	long write_start_pos=out.tellp();//我们需要记录一开始写输出文件的位置，等下要跳回来
+	long bit_count=0;//记录一共写了多少个比特
+	//要在文件中记录一共写了多少个比特，但是这个值要写完整个文件才知道
+	//所以我们要为这个值在文件中预留一个位置，写完整个文件后再跳回来把实际写了多少个比特写到文件中
+	if(format==1){
+		out.write(reinterpret_cast<const char*>(&bit_count),sizeof(bit_count));
+	}else{
+		write_uint64(out,bit_count);
+	}
+	if(!out){
+		return false;
+	}
+	StreamSink sink(out);
+	bool r=(pipeline==0 ? huffman_data_encode_stream(in,sink,enc,threads,bit_count) : huffman_data_encode_pipelined(in,sink,enc,threads,bit_count,*pipeline));
+	if(r==false){
+		return false;
+	}
+	return write_huffman_bit_count(out,write_start_pos,bit_count,format);
+}
+
+//第3版格式的编码长度不能超过这个值，这样解码的时候查一次表一定能解出一个单词，每个子流的解码都没有分支
+#define INTERLEAVED_MAX_CODE_LENGTH 12
+
+//把输入文件按第3版格式编码，写到输出文件
+//第i个单词的编码写到第i%streams个子比特流里，每个子流从头开始都是一个完整的比特流，解码的时候可以同时解
+//编码长度部分后面依次是：
+//  子流数（1字节）
+//  单词数（8字节，大端字节序）
+//  每个子流的比特数（每个8字节，大端字节序），这就是跳转表，解码的时候由它算出每个子流从哪里开始
+//  每个子流的内容，每个子流补齐到整字节
+//子流的比特数要全部编完才知道，所以子流的内容先放在内存里，最后一起写出去，输出不用移动文件指针
+bool huffman_interleaved_encode(ByteSource &in,ostream &out,const HuffmanCodes &hcs,int streams)
+{
+	const size_t inbuf_size=65536;//是8的倍数，每一批第i个单词放到第i%streams个子流里，和整个文件里的顺序一样
+	size_t stream_buf_size=inbuf_size/streams*8+8;
+	vector<vector<unsigned char> > outbufs(streams,vector<unsigned char>(stream_buf_size));
+	vector<vector<unsigned char> > data(streams);//每个子流编码后的内容
+	vector<BitWriter> writers;
+	for(int s=0;s<streams;++s){
+		writers.push_back(BitWriter(&outbufs[s][0],&outbufs[s][0]+stream_buf_size));
+	}
+	unsigned long long symbol_count=0;
+	for(;;){
+		size_t n=0;
+		const unsigned char *p=in.next(inbuf_size,n);
+		if(n==0){
+			break;
+		}
+		symbol_count+=n;
+		for(size_t i=0;i<n;++i){
+			const HuffmanCode &hc=hcs[p[i]];
+			writers[i&(streams-1)].put(hc.code,hc.len);
+		}
+		for(int s=0;s<streams;++s){//一批编完，各个子流的内容接到后面去
+			data[s].insert(data[s].end(),writers[s].data(),writers[s].data()+writers[s].size());
+			writers[s].clear();
+		}
+	}
+	if(in.failed()){
+		return false;
+	}
+
+	out.put(static_cast<char>(streams));
+	write_uint64(out,symbol_count);
+	for(int s=0;s<streams;++s){
+		write_uint64(out,writers[s].position());
+	}
+	for(int s=0;s<streams;++s){
+		writers[s].flush();
+		data[s].insert(data[s].end(),writers[s].data(),writers[s].data()+writers[s].size());
+		if(!data[s].empty()){
+			out.write(reinterpret_cast<const char*>(&data[s][0]),data[s].size());
+		}
+	}
+	if(out){
+		return true;
+	}else{
+		return false;
+	}
+}
+
+//第4版格式默认的块大小，以及允许的最小、最大块大小
+#define DEFAULT_BLOCK_SIZE (1L<<20)
+#define MIN_BLOCK_SIZE (4L<<10)
+#define MAX_BLOCK_SIZE (256L<<20)
+
+//第4版格式结束块后面的块索引，记录每一块在哪里，多线程解压缩的时候不用从头一块一块地找
+//先是每一块的索引项，最后是块数、索引的位置和BLOCK_INDEX_MAGIC，各8个字节
+//位置都从块大小后面第一块开始的地方算，所以压缩的时候不用知道输出文件里的位置，输出可以是管道
+#define BLOCK_INDEX_MAGIC "hzipidx1"
+#define BLOCK_INDEX_ENTRY_SIZE 24
+#define BLOCK_INDEX_TRAILER_SIZE 24
+
+//块索引的一项，每个数都是8字节，大端字节序
+struct BlockIndexEntry{
+	unsigned long long offset;//这块的块头开始的位置
+	unsigned long long bit_count;//这块压缩内容的比特数
+	unsigned long long raw_size;//这块解压缩以后的字节数
+};
+
+typedef vector<BlockIndexEntry> BlockIndex;
+
+//写块索引，index_offset是索引开始的位置，也就是结束块后面
+bool write_block_index(ostream &out,const BlockIndex &index,unsigned long long index_offset){
+	for(size_t i=0;i<index.size();++i){
+		write_uint64(out,index[i].offset);
+		write_uint64(out,index[i].bit_count);
+		write_uint64(out,index[i].raw_size);
+	}
+	write_uint64(out,index.size());
+	write_uint64(out,index_offset);
+	out.write(BLOCK_INDEX_MAGIC,8);
+	if(out){
+		return true;
+	}else{
+		return false;
+	}
+}
+
+//统计内存里一段数据的词汇表，和collect_word_list一样只留下出现过的单词
+TokenList count_word_list(const unsigned char *data,size_t n){
+	long counts[256]={0};
+	histogram_count(data,n,counts);
+	return tokens_from_counts(counts);
+}
+
+//从词汇表建huffman树求出编码长度，超过limit的时候用package-merge算法限制长度，limit是0表示只限制在MAX_CODE_LENGTH以内
+bool create_block_code_lengths(const TokenList &tokens,int limit,HuffmanCodeLengths &lengths){
+	if(limit==0){
+		limit=MAX_CODE_LENGTH;
+	}
+	HuffmanTree ht;
+	create_huffman_tree(ht,tokens);
+	create_huffman_code_lengths(ht,tokens,lengths);
+	if(*max_element(lengths.begin(),lengths.end())>limit){
+		HuffmanCodeLengths limited;
+		if(create_limited_code_lengths(tokens,limit,limited)==false){
+			return false;
+		}
+		lengths=limited;
+	}
+	return true;
+}
+
+//把一块数据单独编码，结果放到block里：
+//  这块的字节数（8字节，大端字节序）
+//  编码长度，和第2版格式一样
+//  压缩内容的比特数（8字节，大端字节序）
+//  压缩内容，补齐到整字节
+//max_code_length是--max-code-length限制的编码长度，bit_count返回压缩内容的比特数，用来写块索引
+//这个函数只用自己的局部变量，多个线程可以同时调用
+bool huffman_block_encode(const unsigned char *data,size_t n,int encode_table,int max_code_length,string &block,unsigned long long &bit_count){
+	TokenList tokens=count_word_list(data,n);
+	HuffmanCodeLengths lengths;
+	HuffmanCodes hcs;
+	if(tokens.empty() || create_block_code_lengths(tokens,max_code_length,lengths)==false){
+		return false;
+	}
+	if(should_store(tokens,lengths,max_code_length,0)){//这块压缩不了多少，存储，块头照常写，压缩内容就是原来的字节
+		ostringstream os;
+		lengths.assign(256,8);
+		bit_count=static_cast<unsigned long long>(n)*8;
+		write_uint64(os,n);
+		write_huffman_code_lengths(os,lengths);
+		write_uint64(os,bit_count);
+		os.write(reinterpret_cast<const char*>(data),n);
+		if(!os){
+			return false;
+		}
+		block=os.str();
+		return true;
+	}
+	if(create_canonical_codes(lengths,hcs)==false){
+		return false;
+	}
+	if(encode_table==ENCODE_TABLE_AUTO){
+		encode_table=choose_encode_table(hcs,tokens);
+	}
+	HuffmanEncoder enc;
+	init_huffman_encoder(enc,hcs,encode_table);
+
+	//编码不会超过n*max_len比特，BitWriter每次存8个字节，最后再补齐一次，多留16个字节
+	vector<unsigned char> outbuf(n/8*enc.max_len+enc.max_len+16);
+	BitWriter bw(&outbuf[0],&outbuf[0]+outbuf.size());
+	encode_huffman_bytes(enc,data,n,bw);
+	bit_count=bw.position();
+	bw.flush();
+
+	ostringstream os;
+	write_uint64(os,n);
+	write_huffman_code_lengths(os,lengths);
+	write_uint64(os,bit_count);
+	os.write(reinterpret_cast<const char*>(bw.data()),bw.size());
+	if(!os){
+		return false;
+	}
+	block=os.str();
+	return true;
+}
+
+//多线程压缩时的一个块
+struct BlockEncodeJob{
+	const unsigned char *data;//这块数据
+	size_t size;//这块的字节数
+	string output;//编码后的结果
+	unsigned long long bit_count;//压缩内容的比特数
+	bool ok;//编码是否成功
+};
+
+//一批要多线程压缩的块
+struct BlockEncodeBatch{
+	vector<BlockEncodeJob> jobs;
+	int encode_table;
+	int max_code_length;
+};
+
+//线程池里的任务：压缩第index块
+void block_encode_task(void *arg,long index){
+	BlockEncodeBatch *batch=static_cast<BlockEncodeBatch*>(arg);
+	BlockEncodeJob &job=batch->jobs[index];
+	job.ok=huffman_block_encode(job.data,job.size,batch->encode_table,batch->max_code_length,job.output,job.bit_count);
+}
+
+//把os里攒的内容写到out，块大小、块索引这些先写到ostringstream里
+bool write_buffered(ByteSink &out,const ostringstream &os){
+	string s=os.str();
+	return out.write(reinterpret_cast<const unsigned char*>(s.data()),s.size());
+}
+
+//按第4版格式压缩：标志头后面是块大小（8字节，大端字节序），然后是一块一块的数据，一个字节数为0的块作为结束，最后是块索引
+//每次读线程数两倍的块，用线程池同时压缩，压缩完按顺序写出去，所以不管用几个线程，压缩出来的文件都一样
+//只顺序读输入、顺序写输出，输入输出都可以是管道
+bool huffman_block_zip(ByteSource &in,ByteSink &out,const HuffmanOptions &opt)
+{
+	ThreadPool pool(opt.threads);
+	size_t block_size=opt.block_size;
+	size_t wave_blocks=pool.size()*2;//一次取的块数
+	BlockEncodeBatch batch;
+	batch.encode_table=opt.encode_table;
+	batch.max_code_length=opt.max_code_length;
+	BlockIndex index;
+	unsigned long long pos=0;//下一块开始的位置，从第一块开始算
+
+	ostringstream head;
+	if(write_uint64(head,block_size)==false || write_buffered(out,head)==false){
+		return false;
+	}
+	for(;;){
+		size_t n=0;
+		const unsigned char *data=in.next(wave_blocks*block_size,n);
+		if(n==0){
+			break;
+		}
+		batch.jobs.assign((n+block_size-1)/block_size,BlockEncodeJob());
+		for(size_t i=0;i<batch.jobs.size();++i){
+			batch.jobs[i].data=data+i*block_size;
+			batch.jobs[i].size=min(block_size,n-i*block_size);
+		}
+		pool.run(block_encode_task,&batch,batch.jobs.size());
+		for(size_t i=0;i<batch.jobs.size();++i){
+			if(batch.jobs[i].ok==false){
+				return false;
+			}
+			BlockIndexEntry entry={pos,batch.jobs[i].bit_count,batch.jobs[i].size};
+			index.push_back(entry);
+			if(out.write(reinterpret_cast<const unsigned char*>(batch.jobs[i].output.data()),batch.jobs[i].output.size())==false){
+				return false;
+			}
+			pos+=batch.jobs[i].output.size();
+		}
+	}
+	if(in.failed()){
+		return false;
+	}
+	ostringstream tail;
+	return write_uint64(tail,0) && write_block_index(tail,index,pos+8) && write_buffered(out,tail);
+}
+
+//输出流水线每个阶段等了多久，what是中间阶段做的事情
+void print_pipeline_stats(const char *what,const PipelineStats &stats){
+	clog<<"流水线：读线程等待 "<<stats.read_wait<<" 秒，"<<what<<"等待输入 "<<stats.input_wait<<" 秒，"
+		<<what<<"等待输出缓冲区 "<<stats.output_wait<<" 秒，写线程等待 "<<stats.write_wait<<" 秒"<<endl;
+}
+
+//使用huffman树的原理进行压缩的函数
+bool huffman_zip(const char *in_filename,const char *out_filename,const HuffmanOptions &opt)
+{
 	HuffmanTree ht;//huffman树
 	TokenList tokens;//词汇表
 	HuffmanCodes hcs;//huffman编码集合
+	HuffmanCodeLengths lengths;//每个单词的编码长度，第2版格式用
 	ifstream in;//输入文件
 	ofstream out;//输出文件
 	bool r=false;//操作是否成功，不成功就是false
 
-	//必须用binary方式打开输入文件，否则系统会在遇到0x0d连着0x0a的时候，把0x0d吞掉
-	//0x0d是'\r'，0x0a是'\n'，如果不使用binary标志，就默认用文本模式打开流，因此会出现
-	//这种转换
-	in.open(in_filename,ios_base::in|ios_base::binary);
-	if(!in){
-		clog<<"无法打开输入文件："<<in_filename<<endl;
+	//第1、2版格式要扫描两遍输入（快速模式除外），还要跳回文件头改比特数，第3版也要扫描两遍
+	//输入是管道、不能倒回去再读，或者输出是管道、不能跳回去改的时候，改用第4版格式流式压缩：
+	//一块一块地读，每块读进来只读一次，统计词汇表、建树、编码，写出去的每块自带块头，不用跳回去改，内存只用块大小乘线程数两倍那么多
+	if(opt.format!=4 && ((opt.fast==false && is_regular_file(in_filename)==false) || (opt.format!=3 && can_map_output(out_filename)==false))){
+		if(opt.format_given){//用户指定的格式写不了，每次都要告诉用户实际写的是第4版
+			clog<<"警告：输入或输出不能移动文件指针，没法按第"<<opt.format<<"版格式压缩，改用第4版格式流式压缩"<<endl;
+		}else if(opt.verbose){
+			clog<<"输入或输出不能移动文件指针，改用第4版格式流式压缩"<<endl;
+		}
+		HuffmanOptions stream_opt=opt;
+		stream_opt.format=4;
+		return huffman_zip(in_filename,out_filename,stream_opt);
+	}
+
+	//必须用binary方式打开输入文件，否则系统会在遇到0x0d连着0x0a的时候，把0x0d吞掉
+	//0x0d是'\r'，0x0a是'\n'，如果不使用binary标志，就默认用文本模式打开流，因此会出现
+	//这种转换
+	in.open(in_filename,ios_base::in|ios_base::binary);
+	if(!in){
+		clog<<"无法打开输入文件："<<in_filename<<endl;
+		return false;
+	}
+	MappedFile input;//普通文件映射到内存里，统计词汇表和编码都直接读映射
+	bool mapped=(opt.mmap && opt.io_uring==false && opt.fast==false && input.map(in_filename));
+	UringSource uring_src;//用io_uring读的时候，编码时一直有几个读请求在后台进行
+	bool uring_in=(opt.io_uring && opt.fast==false && uring_src.open(in_filename,0));
+	if(uring_in && opt.verbose){
+		clog<<(uring_src.uring() ? "读输入用io_uring" : "io_uring不可用，读输入用pread")<<endl;
+	}
+	StreamSource stream_src(in);
+	MemorySource mapped_src(input.data(),input.size());
+	ByteSource &src=(mapped ? static_cast<ByteSource&>(mapped_src) : (uring_in ? static_cast<ByteSource&>(uring_src) : stream_src));//编码时读的输入
+	if(opt.format==4){//第4版格式每块单独统计词汇表，不用先扫描整个文件
+		FdSource stdin_src(STDIN_FILENO);//标准输入输出直接用read、write，不经过文件流
+		FdSink stdout_sink(STDOUT_FILENO);
+		StreamSink stream_sink(out);
+		bool to_stdout=(stdio_fd(out_filename)==STDOUT_FILENO);
+		if(to_stdout==false){
+			out.open(out_filename,ios_base::out|ios_base::binary);
+		}
+		if(to_stdout==false && !out){
+			clog<<"无法打开输出文件："<<out_filename<<endl;
+			return false;
+		}
+		ByteSource &block_src=(stdio_fd(in_filename)==STDIN_FILENO ? static_cast<ByteSource&>(stdin_src) : src);
+		ByteSink &sink=(to_stdout ? static_cast<ByteSink&>(stdout_sink) : stream_sink);
+		ostringstream header;
+		if(write_huffman_zip_header(header,opt.format)==false || write_buffered(sink,header)==false || huffman_block_zip(block_src,sink,opt)==false){
+			clog<<"无法读输入文件或写输出文件："<<in_filename<<" "<<out_filename<<endl;
+			return false;
+		}
+		return true;
+	}
+	double count_start=now_seconds();
+	vector<char> prefix;//快速模式从管道采样时读进来的开头部分
+	vector<long> chunk_counts;//输入映射了的时候每段的计数，用来事先算出每段编码以后的位置
+	if(opt.fast){//只采样估计词汇表，输入只读一遍，管道也可以
+		if(sample_word_list(in,in_filename,tokens,prefix)==false){
+			clog<<"无法读输入文件："<<in_filename<<endl;
+			return false;
+		}
+	}else{
+		if(mapped){
+			tokens=count_word_list_parallel(input.data(),input.size(),opt.threads,&chunk_counts);
+		}else if(collect_word_list_parallel(in_filename,opt.threads,tokens)==false){//管道之类的输入只能一个字节一个字节地读
+			tokens=collect_word_list(in);//扫描输入文件，得到词汇表
+		}
+		if(tokens.size()==0){
+			clog<<"文件为空："<<in_filename<<endl;
+			return false;
+		}
+		//文件已经读到头了，现在是无效状态，我们要把它倒回头，等下好开始读里面的内容好用来做huffman压缩
+		in.clear();
+		in.seekg(0,ios::beg);
+		if(!in){
+			clog<<"无法移动输入文件指针："<<in_filename<<endl;
+			return false;
+		}
+	}
+	if(opt.verbose && opt.fast==false){
+		double seconds=now_seconds()-count_start;
+		long total=0;
+		for(size_t i=0;i<tokens.size();++i){
+			total+=tokens[i].weight;
+		}
+		clog<<"统计词汇表："<<total<<" 字节，"<<opt.threads<<"个线程，耗时 "<<seconds<<" 秒";
+		if(seconds>0){
+			clog<<"，"<<total/seconds/1e6<<" MB/s";
+		}
+		clog<<endl;
+	}
+	long exact_counts[256]={0};//快速模式下编码时统计的实际词汇表
+	SampledSource sampled(stream_src,prefix,opt.verbose ? exact_counts : 0);
+	ByteSource &data_in=(opt.fast ? static_cast<ByteSource&>(sampled) : src);
+
+	create_huffman_tree(ht,tokens);//从词汇表和权重创建huffman树
+	create_huffman_code_lengths(ht,tokens,lengths);
+	int max_len=*max_element(lengths.begin(),lengths.end());
+	int limit=opt.max_code_length;
+	if(limit==0 && max_len>MAX_CODE_LENGTH){//编码表放不下这么长的编码，只好限制长度
+		limit=MAX_CODE_LENGTH;
+	}
+	if(opt.format==3 && (limit==0 || limit>INTERLEAVED_MAX_CODE_LENGTH)){//第3版格式要求查一次表就能解出一个单词
+		limit=INTERLEAVED_MAX_CODE_LENGTH;
+	}
+	if(limit!=0 && max_len>limit){//huffman编码超过了限制的长度，用package-merge算法重新求编码长度
+		HuffmanCodeLengths limited;
+		if(create_limited_code_lengths(tokens,limit,limited)==false){
+			clog<<"单词有"<<tokens.size()<<"个，编码长度不可能限制在"<<limit<<"比特以内："<<in_filename<<endl;
+			return false;
+		}
+		long bits=encoded_bit_count(tokens,lengths), limited_bits=encoded_bit_count(tokens,limited);
+		clog<<"编码长度限制为"<<limit<<"比特（不限制时最长"<<max_len<<"比特）：编码后"<<limited_bits<<"比特，比不限制时的"<<bits<<"比特多"<<(limited_bits-bits)*100.0/bits<<"%"<<endl;
+		lengths=limited;
+		if(opt.format==1){//第1版格式要存huffman树，按限制长度后的编码重建一棵，词汇表还用原来带权重的
+			TokenList canonical_tokens;
+			if(create_canonical_tree(lengths,ht,canonical_tokens)==false){
+				clog<<"无法按限制长度后的编码重建huffman树："<<in_filename<<endl;
+				return false;
+			}
+		}
+	}
+	double gain=0;
+	if(opt.format==2 && should_store(tokens,lengths,limit,&gain)){//压缩不了多少，不用编码，直接存储
+		if(opt.verbose){
+			clog<<"估计压缩以后只比原来小"<<gain<<"%，不到"<<STORED_MIN_GAIN_PERCENT<<"%，不压缩，直接存储"<<endl;
+		}
+		lengths.assign(256,8);
+	}
+	if(opt.format==1){
+		create_huffman_codes(ht,tokens,hcs);//从huffman树、词汇表创建huffman编码集合
+	}else if(create_canonical_codes(lengths,hcs)==false){//第2版格式只用编码长度，按范式huffman编码的规则分配编码
+		clog<<"无法创建范式huffman编码："<<in_filename<<endl;
+		return false;
+	}
+	/*cout<<"下面是生成的huffman编码表："<<endl;//输出我们创建的编码表看看
+	print_huffman_codes(hcs,tokens);*/
+
+	//输入映射了、输出是普通文件的时候，第1、2版格式直接编码到映射的输出文件里，文件头先写到内存里
+	//用io_uring的时候也是文件头先写到内存里，再用pwrite写到文件开头
+	bool map_output=(mapped && opt.format!=3 && can_map_output(out_filename));
+	bool uring_output=(opt.io_uring && opt.format!=3 && can_map_output(out_filename));
+	ostringstream header_out;
+	if(map_output==false && uring_output==false){
+		out.open(out_filename,ios_base::out|ios_base::binary);//打开输出文件，此处一定要用binary模式
+		if(!out){
+			clog<<"无法打开输出文件："<<out_filename<<endl;
+			return false;
+		}
+	}
+	ostream &head_out=(map_output || uring_output ? static_cast<ostream&>(header_out) : out);
+	if(write_huffman_zip_header(head_out,opt.format)==false){//写标志头
+		clog<<"无法写输出文件："<<out_filename<<endl;
+		return false;
+	}
+	if(opt.format==1){
+		r=write_huffman_tree(head_out,ht,tokens);//写huffman树和词汇表
+	}else{
+		r=write_huffman_code_lengths(head_out,lengths);//只写每个单词的编码长度
+	}
+	if(r==false){
+		clog<<"无法写输出文件："<<out_filename<<endl;
+		return false;
+	}
+	int encode_table=opt.encode_table;
+	if(encode_table==ENCODE_TABLE_AUTO){
+		encode_table=choose_encode_table(hcs,tokens);
+	}
+	if(map_output){
+		//每段里每个单词的次数乘编码长度加起来就是这一段编码后的比特数，编码之前就知道每段写在哪里
+		r=huffman_mapped_encode(input.data(),input.size(),header_out.str(),out_filename,hcs,encoded_chunk_starts(chunk_counts,hcs),opt.format,encode_table,opt.threads);
+	}else if(uring_output){
+		r=huffman_uring_encode(data_in,header_out.str(),out_filename,hcs,opt.format,encode_table,opt.threads,opt.verbose);
+	}else if(opt.format==3){
+		r=huffman_interleaved_encode(data_in,out,hcs,opt.streams);//把in里的内容交错地编码到几个子流里
+	}else{
+		PipelineStats stats={0,0,0,0};
+		r=huffman_data_encode(data_in,out,hcs,opt.format,encode_table,opt.threads,opt.pipeline ? &stats : 0);//把in里的内容编码后输出到out
+		if(r && opt.pipeline && opt.verbose){
+			print_pipeline_stats("编码",stats);
+		}
+	}
+	if(r==false){
+		clog<<"无法写输出文件："<<out_filename<<endl;
+		return false;
+	}
+	if(opt.fast && opt.verbose){//和两遍扫描统计出来的最优编码比一比
+		TokenList exact=tokens_from_counts(exact_counts);
+		HuffmanCodeLengths exact_lengths;
+		if(!exact.empty() && create_block_code_lengths(exact,limit,exact_lengths)){
+			long bits=encoded_bit_count(exact,lengths), exact_bits=encoded_bit_count(exact,exact_lengths);
+			clog<<"快速模式：编码后"<<bits<<"比特，比两遍扫描的"<<exact_bits<<"比特多"<<(bits-exact_bits)*100.0/exact_bits<<"%"<<endl;
+		}
+	}
+	in.close();
+	out.close();
+	return true;
+}
+
+//查表解码时一次窥视的比特数，编码长度不超过这个值的单词查一次表就能解出来
+#define DECODE_TABLE_BITS 11
+
+//解码表的一个项目
+struct HuffmanDecodeEntry{
+	int node;//编码不长于DECODE_TABLE_BITS时是叶子节点的下标，否则是从根往下走DECODE_TABLE_BITS步后到达的中间节点的下标
+	unsigned char byte;//叶子节点对应的单词
+	unsigned char len;//单词编码的长度，编码比DECODE_TABLE_BITS长的时候是0，表示还要接着走树
+};
+
+typedef vector<HuffmanDecodeEntry> HuffmanDecodeTable;//解码表，用窥视到的DECODE_TABLE_BITS个比特作下标
+
+//多单词解码表的一个项目最多存放的单词数
+#define DECODE_MULTI_SYMBOLS 4
+
+//多单词解码表的一个项目，窥视到的DECODE_TABLE_BITS个比特里如果包含几个完整的短编码，查一次表就把它们全解出来
+struct HuffmanMultiDecodeEntry{
+	unsigned char bytes[DECODE_MULTI_SYMBOLS];//解出来的单词
+	unsigned char count;//解出来的单词数，0表示第一个单词的编码就比表长，要用单单词解码表来解
+	unsigned char len;//这些单词的编码一共占的比特数
+};
+
+typedef vector<HuffmanMultiDecodeEntry> HuffmanMultiDecodeTable;//多单词解码表，下标和单单词解码表一样
+
+//解码表的种类
+#define DECODE_TABLE_AUTO 0//根据编码长度的分布自动选择
+#define DECODE_TABLE_SINGLE 1//每次查表解一个单词
+#define DECODE_TABLE_MULTI 2//每次查表解多个单词
+
+//从huffman树的pos节点开始往下走，填写解码表，code和depth是从根走到pos的路径和步数
+bool fill_decode_table(const HuffmanTree &ht,const TokenList &tokens,long pos,unsigned long code,int depth,HuffmanDecodeTable &table){
+	long lchild=ht[pos].lchild, rchild=ht[pos].rchild;
+	if(lchild==-1 && rchild==-1){//走到叶子了
+		if(pos>=static_cast<long>(tokens.size())){//叶子节点必须在词汇表范围内，否则文件已损坏
+			return false;
+		}
+		//窥视到的比特中，前depth位是这个单词的编码，后面的比特属于下一个单词，所以后面的比特取什么值都对应同一个表项
+		HuffmanDecodeEntry entry={static_cast<int>(pos),tokens[pos].byte,static_cast<unsigned char>(depth)};
+		unsigned long first=code<<(DECODE_TABLE_BITS-depth);
+		unsigned long count=1UL<<(DECODE_TABLE_BITS-depth);
+		fill(table.begin()+first,table.begin()+first+count,entry);
+		return true;
+	}
+	if(depth==DECODE_TABLE_BITS){//编码比表长，记下走到的中间节点，解码的时候从这里接着一比特一比特的走
+		HuffmanDecodeEntry entry={static_cast<int>(pos),0,0};
+		table[code]=entry;
+		return true;
+	}
+	long n=ht.size();
+	if(lchild<-1 || lchild>=n || rchild<-1 || rchild>=n){//孩子的下标不合法，文件已损坏
+		return false;
+	}
+	//孩子是-1的路走不通（只有一个单词的时候会这样），对应的表项保持无效，解码走到那里就是文件损坏了
+	if(lchild!=-1 && fill_decode_table(ht,tokens,lchild,code<<1,depth+1,table)==false){
+		return false;
+	}
+	if(rchild!=-1 && fill_decode_table(ht,tokens,rchild,(code<<1)|1,depth+1,table)==false){
+		return false;
+	}
+	return true;
+}
+
+//通过huffman树和词汇表创建解码表
+bool create_decode_table(const HuffmanTree &ht,const TokenList &tokens,HuffmanDecodeTable &table){
+	HuffmanDecodeEntry default_entry={-1,0,0};//无效表项
+	table.assign(1UL<<DECODE_TABLE_BITS,default_entry);
+	return fill_decode_table(ht,tokens,ht.size()-1,0,0,table);//从根开始走
+}
+
+//通过单单词解码表创建多单词解码表
+//对每个表项，先解出第一个单词，把用掉的比特移走以后，剩下的比特如果还能查出一个完整的单词，就接着解，直到凑满DECODE_MULTI_SYMBOLS个单词
+void create_multi_decode_table(const HuffmanDecodeTable &table,HuffmanMultiDecodeTable &multi){
+	unsigned long size=table.size();
+	unsigned long mask=size-1;
+	multi.resize(size);
+	for(unsigned long i=0;i<size;++i){
+		HuffmanMultiDecodeEntry entry;
+		memset(&entry,0,sizeof(entry));
+		int used=0;//已经用掉的比特数
+		while(entry.count<DECODE_MULTI_SYMBOLS){
+			const HuffmanDecodeEntry &e=table[(i<<used)&mask];//把用掉的比特移走，后面补0
+			if(e.len==0 || used+e.len>DECODE_TABLE_BITS){//下一个单词的编码不完全在窥视到的比特里
+				break;
+			}
+			entry.bytes[entry.count++]=e.byte;
+			used+=e.len;
+		}
+		entry.len=used;
+		multi[i]=entry;
+	}
+}
+
+//计算huffman树的平均编码长度，每个单词按编码长度隐含的概率2^-len加权
+//只用到编码长度，不用词汇表的权重
+double implied_average_code_length(const HuffmanTree &ht,long pos,int depth){
+	if(ht[pos].lchild==-1 && ht[pos].rchild==-1){
+		return depth*ldexp(1.0,-depth);
+	}
+	double sum=0;
+	if(ht[pos].lchild!=-1){
+		sum+=implied_average_code_length(ht,ht[pos].lchild,depth+1);
+	}
+	if(ht[pos].rchild!=-1){
+		sum+=implied_average_code_length(ht,ht[pos].rchild,depth+1);
+	}
+	return sum;
+}
+
+//根据编码长度的分布选择解码表的种类
+//平均编码长度不超过窥视比特数的一半时，平均一次查表至少能解出两个单词，用多单词解码表划算
+int choose_decode_table(const HuffmanTree &ht){
+	double average=implied_average_code_length(ht,ht.size()-1,0);
+	if(average*2<=DECODE_TABLE_BITS){
+		return DECODE_TABLE_MULTI;
+	}
+	return DECODE_TABLE_SINGLE;
+}
+
+//用解码表从比特流reader中解出bit_count个比特，结果写到out
+//每次从比特流中窥视DECODE_TABLE_BITS个比特，查解码表得到单词和它的编码长度，只消耗掉编码长度那么多比特
+//只有编码比DECODE_TABLE_BITS长的单词，才退回到一比特一比特地走huffman树
+//multi不是空的时候先查多单词解码表，一次查表可以解出好几个短编码的单词
+//Reader可以是BitReader（整块读进内存的比特流）或者SourceBitReader（从ByteSource一段一段取的比特流）
+template<typename Reader>
+bool decode_huffman_bits(Reader &reader,long bit_count,ByteSink &out,const HuffmanTree &ht,const TokenList &tokens,
+		const HuffmanDecodeTable &table,const HuffmanMultiDecodeTable &multi)
+{
+	bool use_multi=!multi.empty();
+	long remain=bit_count;//还没解码的比特数，比特流最后补齐的比特不会被用到
+
+	const size_t outbuf_size=65536;//攒够一批再写到输出文件，不要每个字节写一次
+	unsigned char outbuf[outbuf_size+DECODE_MULTI_SYMBOLS];//多出来的空间给多单词解码用
+	size_t outlen=0;
+
+	while(remain>0){
+		if(reader.available()<=DECODE_TABLE_BITS){//不够窥视一次的了，把窗口补满
+			reader.refill();
+		}
+		unsigned long index=reader.peek(DECODE_TABLE_BITS);
+		if(use_multi){
+			const HuffmanMultiDecodeEntry &m=multi[index];
+			if(m.count!=0 && m.len<=remain){//一次查表解出好几个单词，最后不够一个表项的比特时才用单单词解码表
+				memcpy(outbuf+outlen,m.bytes,DECODE_MULTI_SYMBOLS);//总是复制DECODE_MULTI_SYMBOLS个字节，多复制的会被后面的单词覆盖
+				outlen+=m.count;
+				reader.consume(m.len);
+				remain-=m.len;
+				if(outlen>=outbuf_size){
+					if(out.write(outbuf,outlen)==false){
+						return false;
+					}
+					outlen=0;
+				}
+				continue;
+			}
+		}
+		const HuffmanDecodeEntry &entry=table[index];//窥视DECODE_TABLE_BITS个比特查表
+		if(entry.len!=0){//一次就查到了单词
+			if(entry.len>remain){
+				return false;//编码超出了文件记录的比特数，说明解码出错，输入文件可能被损坏了
+			}
+			reader.consume(entry.len);
+			remain-=entry.len;
+			outbuf[outlen++]=entry.byte;//把单词输出到out
+		}else{//编码比表长，先消耗掉窥视的比特，再从中间节点开始一比特一比特的往叶子走
+			long huffpos=entry.node;
+			if(huffpos<0 || remain<DECODE_TABLE_BITS){//无效表项，或者编码超出了文件记录的比特数
+				return false;
+			}
+			reader.consume(DECODE_TABLE_BITS);
+			remain-=DECODE_TABLE_BITS;
+			while(ht[huffpos].lchild!=-1 || ht[huffpos].rchild!=-1){//还没走到叶子
+				if(remain==0){
+					return false;
+				}
+				if(reader.available()<=8){
+					reader.refill();
+				}
+				bool bit=reader.peek(1)!=0;
+				reader.consume(1);
+				--remain;
+				huffpos=bit ? ht[huffpos].rchild : ht[huffpos].lchild;//在读到1的时候往右走，在读到比特0时往左走
+				if(huffpos<0 || huffpos>=static_cast<long>(ht.size())){
+					return false;//没路可走了，说明解码出错，输入文件可能被损坏了
+				}
+			}
+			if(huffpos>=static_cast<long>(tokens.size())){
+				return false;
+			}
+			outbuf[outlen++]=tokens[huffpos].byte;//把叶子节点对应的单词输出到out
+		}
+		if(outlen>=outbuf_size){
+			if(out.write(outbuf,outlen)==false){
+				return false;
+			}
+			outlen=0;
+		}
+	}
+	return out.write(outbuf,outlen);
+}
+
+//看看输入文件能不能移动文件指针，能的话求出从当前位置到文件尾还有多少字节
+//管道之类的输入不能移动文件指针，返回false
+bool remaining_stream_size(istream &in,long &size){
+	streampos pos=in.tellg();
+	if(pos==streampos(-1)){
+		in.clear();
+		return false;
+	}
+	in.seekg(0,ios::end);
+	streampos end=in.tellg();
+	in.seekg(pos);
+	if(!in || end==streampos(-1)){
+		in.clear();
+		in.seekg(pos);
+		return false;
+	}
+	size=end-pos;
+	return true;
+}
+
+//从reader里解一个单词放到byte里，返回编码长度，遇到不合法的编码返回0
+//只用单单词解码表，每解一个单词都知道它从哪个比特开始，推测解码要用
+inline int decode_huffman_symbol(BitReader &reader,const HuffmanTree &ht,const TokenList &tokens,const HuffmanDecodeTable &table,unsigned char &byte){
+	if(reader.available()<=DECODE_TABLE_BITS){
+		reader.refill();
+	}
+	const HuffmanDecodeEntry &entry=table[reader.peek(DECODE_TABLE_BITS)];
+	if(entry.len!=0){
+		reader.consume(entry.len);
+		byte=entry.byte;
+		return entry.len;
+	}
+	long huffpos=entry.node;
+	if(huffpos<0){
+		return 0;
+	}
+	reader.consume(DECODE_TABLE_BITS);
+	int len=DECODE_TABLE_BITS;
+	while(ht[huffpos].lchild!=-1 || ht[huffpos].rchild!=-1){//还没走到叶子
+		if(len>=static_cast<int>(ht.size())){//比树还深，树已经损坏了
+			return 0;
+		}
+		if(reader.available()<=8){
+			reader.refill();
+		}
+		bool bit=reader.peek(1)!=0;
+		reader.consume(1);
+		++len;
+		huffpos=bit ? ht[huffpos].rchild : ht[huffpos].lchild;
+		if(huffpos<0 || huffpos>=static_cast<long>(ht.size())){
+			return 0;
+		}
+	}
+	if(huffpos>=static_cast<long>(tokens.size())){
+		return 0;
+	}
+	byte=tokens[huffpos].byte;
+	return len;
+}
+
+//推测解码时每个线程负责的比特数，比这少的比特流不值得多线程解码
+#define SPECULATIVE_RANGE_BITS (8L<<20)
+//推测解码的线程从猜的位置开始解码，要在开头这么多比特以内和前一段的单词边界对上，对不上就退回到一个线程解码
+#define SPECULATIVE_SYNC_BITS 65536
+
+//推测解码时记下的一个单词边界
+struct SyncPoint{
+	uint64_t pos;//单词开始的比特位置
+	size_t index;//这个单词在这一段输出里的下标
+};
+
+//推测解码时一个线程负责的一段比特流
+struct SpeculativeRange{
+	uint64_t start;//从这个比特开始解码，除了每批的第一段，都是猜的，不一定是单词的边界
+	uint64_t end;//解到第一个从end或者end以后开始的单词为止
+	uint64_t stop;//解码停下来的位置
+	vector<unsigned char> output;//这一段解出来的单词，后面接着续解到和下一段对上为止的单词
+	vector<SyncPoint> sync;//开头SPECULATIVE_SYNC_BITS比特以内每个单词的边界
+	size_t skip;//输出里前面这么多个单词是从错误的位置解出来的，要扔掉
+	bool decoded;//第一遍解码成功，只在speculative_decode_task里写，接着往下解的时候前一段的线程要读
+	bool synced;//接着往下解和下一段对上了，只在这一段自己的speculative_sync_task里写
+};
+
+//一批推测解码的比特流
+struct SpeculativeBatch{
+	vector<SpeculativeRange> ranges;
+	const unsigned char *payload;
+	size_t payload_size;
+	uint64_t bit_count;
+	const HuffmanTree *ht;
+	const TokenList *tokens;
+	const HuffmanDecodeTable *table;
+};
+
+//在payload的pos比特处开始读的BitReader
+BitReader bit_reader_at(const unsigned char *payload,size_t payload_size,uint64_t pos){
+	BitReader reader(payload+pos/8,payload+payload_size);
+	reader.consume(pos%8);
+	return reader;
+}
+
+//线程池里的任务：从第index段开头猜的位置开始解码，一直解到这一段的末尾，开头的单词边界都记下来
+void speculative_decode_task(void *arg,long index){
+	SpeculativeBatch *batch=static_cast<SpeculativeBatch*>(arg);
+	SpeculativeRange &range=batch->ranges[index];
+	range.decoded=false;
+	range.synced=false;
+	range.skip=0;
+	range.output.clear();
+	range.sync.clear();
+	range.output.reserve((range.end-range.start)/2);
+	BitReader reader=bit_reader_at(batch->payload,batch->payload_size,range.start);
+	uint64_t pos=range.start;
+	uint64_t sync_end=min(range.start+SPECULATIVE_SYNC_BITS,range.end);
+	while(pos<range.end){
+		if(pos<sync_end){
+			SyncPoint p={pos,range.output.size()};
+			range.sync.push_back(p);
+		}
+		unsigned char byte;
+		int len=decode_huffman_symbol(reader,*batch->ht,*batch->tokens,*batch->table,byte);
+		if(len==0 || pos+len>batch->bit_count){//猜的位置不对也可能解出不合法的编码
+			return;
+		}
+		range.output.push_back(byte);
+		pos+=len;
+	}
+	range.stop=pos;
+	range.decoded=true;
+}
+
+//线程池里的任务：第index段从停下来的地方接着往下一段里解码，直到单词边界和下一段记下的某个边界重合
+//第index段从这里往后都是正确的单词（前一段接上它的时候已经确认了），重合以后下一段也就正确了，记下下一段要扔掉多少个单词
+void speculative_sync_task(void *arg,long index){
+	SpeculativeBatch *batch=static_cast<SpeculativeBatch*>(arg);
+	SpeculativeRange &range=batch->ranges[index];
+	SpeculativeRange &next=batch->ranges[index+1];
+	if(range.decoded==false || next.decoded==false){
+		return;
+	}
+	BitReader reader=bit_reader_at(batch->payload,batch->payload_size,range.stop);
+	uint64_t pos=range.stop;
+	size_t j=0;
+	for(;;){
+		while(j<next.sync.size() && next.sync[j].pos<pos){
+			++j;
+		}
+		if(j==next.sync.size()){//在下一段开头记下的边界里都没对上
+			return;
+		}
+		if(next.sync[j].pos==pos){
+			next.skip=next.sync[j].index;
+			range.synced=true;
+			return;
+		}
+		unsigned char byte;
+		int len=decode_huffman_symbol(reader,*batch->ht,*batch->tokens,*batch->table,byte);
+		if(len==0){
+			return;
+		}
+		range.output.push_back(byte);
+		pos+=len;
+	}
+}
+
+//推测地多线程解码第1、2版格式的单个比特流，payload是整个压缩内容
+//每批把比特流分成线程数两倍的段，第一段从已知的单词边界开始，其余的段从猜的位置开始，由线程池同时解码
+//huffman编码从错误的位置开始解码，通常几十个比特以后就会和正确的单词边界重合，从那里往后解出来的就都对了
+//每段解完以后再接着往下一段里解，和下一段的单词边界对上的地方就是下一段开始正确的地方
+//某一段在开头SPECULATIVE_SYNC_BITS比特以内没对上，就从这批的开头一个线程解码剩下的所有内容
+bool huffman_speculative_decode(const unsigned char *payload,size_t payload_size,long bit_count,ByteSink &out,const HuffmanTree &ht,
+		const TokenList &tokens,const HuffmanDecodeTable &table,const HuffmanMultiDecodeTable &multi,int threads)
+{
+	ThreadPool pool(threads);
+	size_t wave_ranges=pool.size()*2;//一批的段数
+	SpeculativeBatch batch;
+	batch.payload=payload;
+	batch.payload_size=payload_size;
+	batch.bit_count=bit_count;
+	batch.ht=&ht;
+	batch.tokens=&tokens;
+	batch.table=&table;
+	uint64_t pos=0;//已经解完的位置，一定是单词的边界
+	while(static_cast<long>(pos)<bit_count){
+		uint64_t remain=bit_count-pos;
+		size_t count=min(static_cast<uint64_t>(wave_ranges),(remain+SPECULATIVE_RANGE_BITS-1)/SPECULATIVE_RANGE_BITS);
+		batch.ranges.resize(count);
+		for(size_t i=0;i<count;++i){
+			batch.ranges[i].start=pos+i*SPECULATIVE_RANGE_BITS;
+			batch.ranges[i].end=(i+1<count ? batch.ranges[i].start+SPECULATIVE_RANGE_BITS : min(pos+count*SPECULATIVE_RANGE_BITS,static_cast<uint64_t>(bit_count)));
+		}
+		pool.run(speculative_decode_task,&batch,count);
+		pool.run(speculative_sync_task,&batch,count-1);
+		bool synced=true;
+		for(size_t i=0;i<count && synced;++i){
+			synced=batch.ranges[i].decoded && (i+1==count || batch.ranges[i].synced);//最后一段不用和后面对上
+		}
+		if(synced==false){//没对上，剩下的一个线程解码
+			BitReader reader=bit_reader_at(payload,payload_size,pos);
+			return decode_huffman_bits(reader,bit_count-pos,out,ht,tokens,table,multi);
+		}
+		for(size_t i=0;i<count;++i){
+			const SpeculativeRange &range=batch.ranges[i];
+			if(range.output.size()>range.skip && out.write(&range.output[0]+range.skip,range.output.size()-range.skip)==false){
+				return false;
+			}
+		}
+		pos=batch.ranges[count-1].stop;//最后一段停下来的位置是下一批开始的单词边界
+	}
+	return static_cast<long>(pos)==bit_count;
+}
+
+//解码in里bit_count个比特的压缩内容，结果写到out
+//能移动文件指针的输入文件，把压缩内容一次读进内存，用BitReader解码，管道之类的输入用SourceBitReader边读边解码
+//pipeline不是空的时候，除了映射到内存里的输入和多线程推测解码，都在读线程里读压缩内容，边读边解码
+//payload_in不是空的时候压缩内容从payload_in读（比如UringSource），不用in
+bool huffman_payload_decode(istream &in,ByteSink &out,long bit_count,const HuffmanTree &ht,const TokenList &tokens,
+		const HuffmanDecodeTable &table,const HuffmanMultiDecodeTable &multi,int threads,PipelineStats *pipeline,ByteSource *payload_in)
+{
+	long size=0;
+	bool seekable=remaining_stream_size(in,size);
+	long payload_size=bit_count/8+(bit_count%8 ? 1 : 0);//压缩内容占的字节数
+	if(seekable && payload_size>size){//文件比记录的比特数短，已经损坏了
+		return false;
+	}
+	bool memory_input=(dynamic_cast<MemoryInBuf*>(in.rdbuf())!=0);
+	bool speculative=(seekable && threads>1 && bit_count>=2*SPECULATIVE_RANGE_BITS);
+	if(pipeline!=0 && memory_input==false && speculative==false && payload_in==0){
+		StreamSource source(in);
+		ThreadedSource threaded_in(source,PIPELINE_BUFFERS,PIPELINE_BUFFER_SIZE);
+		SourceBitReader reader(threaded_in);
+		bool r=decode_huffman_bits(reader,bit_count,out,ht,tokens,table,multi);
+		threaded_in.stop();//SourceBitReader会往前多取一段，读线程不一定结束了
+		pipeline->read_wait=threaded_in.read_wait();
+		pipeline->input_wait=threaded_in.input_wait();
+		return r;
+	}
+	if(seekable==false){//管道之类的输入，边读边解码
+		StreamSource source(in);
+		SourceBitReader reader(source);
+		return decode_huffman_bits(reader,bit_count,out,ht,tokens,table,multi);
+	}
+	vector<unsigned char> copy;
+	const unsigned char *payload=0;
+	if(payload_in!=0){//一次读进来，读的时候有几个读请求同时进行
+		copy.resize(payload_size>0 ? payload_size : 1);
+		payload=(payload_in->read(&copy[0],payload_size)==static_cast<size_t>(payload_size) ? &copy[0] : 0);
+	}else{
+		payload=read_payload(in,payload_size,copy);//输入映射到内存的时候不用复制
+	}
+	if(payload==0){
+		return false;
+	}
+	if(speculative){
+		return huffman_speculative_decode(payload,payload_size,bit_count,out,ht,tokens,table,multi,threads);
+	}
+	BitReader reader(payload,payload+payload_size);
+	return decode_huffman_bits(reader,bit_count,out,ht,tokens,table,multi);
+}
+
+//通过从输入文件中读出的huffman树，对输入解码并把结果写到输出文件
+//能移动文件指针的输入文件，把压缩内容一次读进内存，用BitReader解码，管道之类的输入用SourceBitReader边读边解码
+//decode_table是解码表的种类，用多单词解码表的时候一次查表可以解出好几个短编码的单词
+//format是压缩文件格式的版本，两个版本记录比特数的方式不一样
+//threads大于1并且压缩内容够长的时候，用huffman_speculative_decode推测地多线程解码
+//pipeline不是空的时候读输入和写输出各用一个线程，和解码同时进行，每个阶段等了多久记到pipeline里
+//payload_in不是空的时候，比特数还从in读，后面的压缩内容从payload_in读，payload_in要从比特数后面开始
+bool huffman_data_decode(istream &in,ByteSink &out,const HuffmanTree &ht,const TokenList &tokens,int format,int decode_table,int threads,PipelineStats *pipeline,
+		ByteSource *payload_in)
+{
+	long bit_count=0;//从文件中读出原来写下的比特数，放在这里
+
+	if(format==1){
+		in.read(reinterpret_cast<char*>(&bit_count),sizeof(bit_count));//读出此文件后面内容占的比特数
+	}else{
+		unsigned long long count=0;
+		if(read_uint64(in,count)==false || count>static_cast<unsigned long long>(numeric_limits<long>::max())){
+			return false;
+		}
+		bit_count=count;
+	}
+	if(!in || bit_count<0){
+		return false;
+	}
+	if(ht.size()==1){//如果huffman树只有一个节点（第1版格式的词汇表只有一项），那就简单了，直接把这一项输出weight次到out中就行
+		vector<unsigned char> outbuf(min(tokens[0].weight,65536L),tokens[0].byte);//一次写一批，不要每个字节写一次
+		for(long remain=tokens[0].weight;remain>0;remain-=outbuf.size()){
+			if(out.write(&outbuf[0],min(remain,static_cast<long>(outbuf.size())))==false){
+				return false;
+			}
+		}
+		return true;
+	}
+
+	HuffmanDecodeTable table;
+	if(create_decode_table(ht,tokens,table)==false){//huffman树不完整，文件已损坏
+		return false;
+	}
+	if(decode_table==DECODE_TABLE_AUTO){
+		decode_table=choose_decode_table(ht);
+	}
+	HuffmanMultiDecodeTable multi;
+	if(decode_table==DECODE_TABLE_MULTI){
+		create_multi_decode_table(table,multi);
+	}
+	if(bit_count==0){
+		return true;
+	}
+	if(pipeline==0){
+		return huffman_payload_decode(in,out,bit_count,ht,tokens,table,multi,threads,0,payload_in);
+	}
+	ThreadedSink threaded_out(out,PIPELINE_BUFFERS,PIPELINE_BUFFER_SIZE);
+	bool r=huffman_payload_decode(in,threaded_out,bit_count,ht,tokens,table,multi,threads,pipeline,payload_in);
+	bool finished=threaded_out.finish();//出错的时候也要等写线程结束
+	pipeline->output_wait=threaded_out.output_wait();
+	pipeline->write_wait=threaded_out.write_wait();
+	return r && finished;
+}
+
+//第3版格式的解码表，下标是窥视到的INTERLEAVED_MAX_CODE_LENGTH个比特，低8位是单词，8到15位是编码长度，0表示不合法的编码
+typedef vector<uint32_t> InterleavedDecodeTable;
+
+//从编码长度创建第3版格式的解码表，编码长度超过INTERLEAVED_MAX_CODE_LENGTH的时候返回false
+bool create_interleaved_decode_table(const HuffmanCodeLengths &lengths,InterleavedDecodeTable &table){
+	if(*max_element(lengths.begin(),lengths.end())>INTERLEAVED_MAX_CODE_LENGTH){
 		return false;
 	}
-	tokens=collect_word_list(in);//扫描输入文件，得到词汇表
-	if(tokens.size()==0){
-		clog<<"文件为空："<<in_filename<<endl;
+	HuffmanCodes hcs;
+	if(create_canonical_codes(lengths,hcs)==false){
 		return false;
 	}
-	//文件已经读到头了，现在是无效状态，我们要把它倒回头，等下好开始读里面的内容好用来做huffman压缩
-	in.clear();
-	in.seekg(0,ios::beg);
-	if(!in){
-		clog<<"无法移动输入文件指针："<<in_filename<<endl;
+	table.assign(1<<INTERLEAVED_MAX_CODE_LENGTH,0);
+	for(int i=0;i<256;++i){
+		int len=hcs[i].len;
+		if(len==0){
+			continue;
+		}
+		//以这个编码开头的窥视比特都解出这个单词
+		uint32_t first=static_cast<uint32_t>(hcs[i].code)<<(INTERLEAVED_MAX_CODE_LENGTH-len);
+		uint32_t count=1U<<(INTERLEAVED_MAX_CODE_LENGTH-len);
+		for(uint32_t k=0;k<count;++k){
+			table[first+k]=i|(len<<8);
+		}
+	}
+	return true;
+}
+
+//一个一个子流轮流解码，每轮每个子流解一个单词，解rounds轮，结果放到out里
+//同一轮里各个子流的查表互相不依赖，CPU可以同时做，子流数是模板参数，内层循环可以完全展开
+//每次补充窗口以后至少有57个比特，编码不超过12比特，所以每4轮补充一次
+template<int STREAMS>
+bool decode_interleaved_rounds(vector<BitReader> &readers,const InterleavedDecodeTable &table,unsigned char *out,size_t rounds)
+{
+	BitReader local[STREAMS];//复制到局部数组里，编译器可以把它们放在寄存器里
+	for(int s=0;s<STREAMS;++s){
+		local[s]=readers[s];
+	}
+	uint32_t invalid=0;//遇到不合法的编码时编码长度是0
+	size_t r=0;
+	while(r<rounds){
+		for(int s=0;s<STREAMS;++s){
+			local[s].refill();
+		}
+		size_t group_end=min(rounds,r+4);
+		for(;r<group_end;++r){
+			for(int s=0;s<STREAMS;++s){
+				uint32_t entry=table[local[s].peek(INTERLEAVED_MAX_CODE_LENGTH)];
+				out[r*STREAMS+s]=static_cast<unsigned char>(entry);
+				invalid|=(entry<0x100);
+				local[s].consume(entry>>8);
+			}
+		}
+	}
+	for(int s=0;s<STREAMS;++s){
+		readers[s]=local[s];
+	}
+	return invalid==0;
+}
+
+//对第3版格式的压缩内容解码，输出到out
+//把所有子流读进内存，按跳转表为每个子流建一个BitReader，每轮从每个子流解一个单词，按顺序输出
+//8个子流并且CPU支持AVX2的时候，用SimdDecoder.h里的AVX2版本同时解8个子流，decode_table是DECODE_TABLE_SINGLE时不用
+//每个子流解完以后用掉的比特数必须和跳转表里记录的一样，否则文件已损坏
+bool huffman_interleaved_decode(istream &in,ostream &out,const HuffmanCodeLengths &lengths,int decode_table)
+{
+	int streams=in.get();
+	unsigned long long symbol_count=0;
+	if(!in || (streams!=4 && streams!=8) || read_uint64(in,symbol_count)==false){
+		return false;
+	}
+	vector<unsigned long long> stream_bits(streams);
+	vector<unsigned long long> stream_start(streams+1,0);//每个子流在压缩内容里开始的字节位置
+	for(int s=0;s<streams;++s){
+		if(read_uint64(in,stream_bits[s])==false || stream_bits[s]>(1ULL<<60)){
+			return false;
+		}
+		stream_start[s+1]=stream_start[s]+(stream_bits[s]+7)/8;
+	}
+	unsigned long long payload_size=stream_start[streams];
+	long size=0;
+	if(remaining_stream_size(in,size) && payload_size>static_cast<unsigned long long>(size)){//文件比跳转表记录的短，已经损坏了
+		return false;
+	}
+	InterleavedDecodeTable table;
+	if(create_interleaved_decode_table(lengths,table)==false){
 		return false;
 	}
 
-	create_huffman_tree(ht,tokens);//从词汇表和权重创建huffman树
-	create_huffman_codes(ht,tokens,hcs);//从huffman树、词汇表创建huffman编码集合
-	/*cout<<"下面是生成的huffman编码表："<<endl;//输出我们创建的编码表看看
-	print_huffman_codes(hcs,tokens);*/
+	//后面多留8个字节，BitReader和AVX2读过子流末尾的时候都读到0
+	vector<unsigned char> payload(payload_size+8,0);
+	if(payload_size>0 && !in.read(reinterpret_cast<char*>(&payload[0]),payload_size)){
+		return false;
+	}
+	vector<BitReader> readers;
+	for(int s=0;s<streams;++s){
+		readers.push_back(BitReader(&payload[0]+stream_start[s],&payload[0]+stream_start[s+1]));
+	}
 
-	out.open(out_filename,ios_base::out|ios_base::binary);//打开输出文件，此处一定要用binary模式
-	if(!out){
-		clog<<"无法打开输出文件："<<out_filename<<endl;
+	bool use_simd=(streams==SIMD_DECODE_STREAMS && decode_table!=DECODE_TABLE_SINGLE && simd_decode_supported()
+		&& payload_size+SIMD_DECODE_PADDING<static_cast<unsigned long long>(numeric_limits<int32_t>::max()));
+	int32_t offset[SIMD_DECODE_STREAMS], shift[SIMD_DECODE_STREAMS];//AVX2解码时每个子流的字节位置和字节内用掉的比特数
+	for(int s=0;s<streams;++s){
+		offset[s]=static_cast<int32_t>(min(stream_start[s],payload_size));
+		shift[s]=0;
+	}
+
+	//一次解一批单词写到输出文件，一批是子流数的整数倍
+	const size_t outbuf_size=65536;
+	vector<unsigned char> outbuf(outbuf_size);
+	unsigned long long total_rounds=symbol_count/streams;
+	for(unsigned long long done=0;done<total_rounds;){
+		size_t rounds=min(static_cast<unsigned long long>(outbuf_size/streams),total_rounds-done);
+		bool ok=false;
+		if(use_simd){
+			ok=simd_decode_interleaved(&payload[0],&table[0],INTERLEAVED_MAX_CODE_LENGTH,offset,shift,&outbuf[0],rounds);
+		}else if(streams==4){
+			ok=decode_interleaved_rounds<4>(readers,table,&outbuf[0],rounds);
+		}else{
+			ok=decode_interleaved_rounds<8>(readers,table,&outbuf[0],rounds);
+		}
+		if(ok==false){
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(&outbuf[0]),rounds*streams);
+		if(!out){
+			return false;
+		}
+		done+=rounds;
+	}
+
+	//最后不满一轮的单词在前几个子流里，一个一个解
+	vector<unsigned long long> used(streams);//每个子流用掉的比特数
+	for(int s=0;s<streams;++s){
+		if(use_simd){//AVX2解码只记录了位置，从那里开始建一个BitReader接着解
+			readers[s]=BitReader(&payload[0]+offset[s],&payload[0]+max(stream_start[s+1],static_cast<unsigned long long>(offset[s])));
+			readers[s].consume(shift[s]);
+		}
+		uint64_t base_bits=use_simd ? (offset[s]-stream_start[s])*8 : 0;
+		if(static_cast<unsigned long long>(s)<symbol_count%streams){
+			readers[s].refill();
+			uint32_t entry=table[readers[s].peek(INTERLEAVED_MAX_CODE_LENGTH)];
+			if(entry<0x100){
+				return false;
+			}
+			readers[s].consume(entry>>8);
+			out.put(static_cast<char>(entry));
+		}
+		used[s]=base_bits+readers[s].position();
+	}
+	for(int s=0;s<streams;++s){
+		if(used[s]!=stream_bits[s]){
+			return false;
+		}
+	}
+	if(out){
+		return true;
+	}else{
 		return false;
 	}
-	if(write_huffman_zip_header(out)==false){//写标志头
-		clog<<"无法写输出文件："<<out_filename<<endl;
+}
+
+//解码第4版格式的一块，payload是这块的压缩内容，解出来的out_size个字节放到out里
+//解出来的字节数和块头里记录的不一样的时候返回false，这个函数只用自己的局部变量，多个线程可以同时调用
+bool huffman_block_decode(const unsigned char *payload,size_t payload_size,long bit_count,const HuffmanCodeLengths &lengths,
+		int decode_table,unsigned char *out,size_t out_size)
+{
+	if(stored_code_lengths(lengths)){//存储的块，直接复制
+		if(static_cast<unsigned long long>(bit_count)!=static_cast<unsigned long long>(out_size)*8 || payload_size<out_size){
+			return false;
+		}
+		memcpy(out,payload,out_size);
+		return true;
+	}
+	HuffmanTree ht;
+	TokenList tokens;
+	HuffmanDecodeTable table;
+	if(create_canonical_tree(lengths,ht,tokens)==false || create_decode_table(ht,tokens,table)==false){
 		return false;
 	}
-	if(write_huffman_tree(out,ht,tokens)==false){//写huffman树和词汇表
-		clog<<"无法写输出文件："<<out_filename<<endl;
+	if(decode_table==DECODE_TABLE_AUTO){
+		decode_table=choose_decode_table(ht);
+	}
+	HuffmanMultiDecodeTable multi;
+	if(decode_table==DECODE_TABLE_MULTI){
+		create_multi_decode_table(table,multi);
+	}
+	MemorySink sink(out,out_size);
+	BitReader reader(payload,payload+payload_size);
+	if(decode_huffman_bits(reader,bit_count,sink,ht,tokens,table,multi)==false){
 		return false;
 	}
-	if(huffman_data_encode(in,out,hcs)==false){//把in里的内容编码后输出到out
-		clog<<"无法写输出文件："<<out_filename<<endl;
+	return sink.written()==out_size;
+}
+
+//读第4版格式一块的块头：这块的字节数，编码长度，压缩内容的比特数，字节数为0表示结束了
+//块头里的数不合理的时候返回false
+bool read_block_header(istream &in,size_t block_size,unsigned long long &raw_size,HuffmanCodeLengths &lengths,unsigned long long &bit_count){
+	if(read_uint64(in,raw_size)==false || raw_size>block_size){
 		return false;
 	}
-	in.close();
-	out.close();
-	return true;
+	if(raw_size==0){
+		return true;
+	}
+	if(read_huffman_code_lengths(in,lengths)==false || read_uint64(in,bit_count)==false){
+		return false;
+	}
+	//每个单词的编码至少1比特，最多MAX_CODE_LENGTH比特
+	return bit_count>=raw_size && bit_count<=raw_size*MAX_CODE_LENGTH;
 }
 
-//通过从输入文件中读出的huffman树，对输入解码并把结果写到输出文件
-bool huffman_data_decode(istream &in,ostream &out,const HuffmanTree &ht,const TokenList &tokens)
+//读第4版格式标志头后面的块大小
+bool read_block_size(istream &in,unsigned long long &block_size){
+	return read_uint64(in,block_size) && block_size>=static_cast<unsigned long long>(MIN_BLOCK_SIZE) && block_size<=static_cast<unsigned long long>(MAX_BLOCK_SIZE);
+}
+
+//按第4版格式解压缩，一块一块地读进来解码，每块解完就写出去，in要停在第一块开始的地方
+//读到结束块就停下来，后面的块索引不用读，输入可以是管道
+bool huffman_block_unzip(istream &in,ByteSink &out,unsigned long long block_size,int decode_table)
 {
-	long bit_count=0;//从文件中读出原来写下的比特数，放在这里
-	long read_count=0;//记录我们在后面操作中实际读出的比特数
+	vector<unsigned char> payload;
+	vector<unsigned char> outbuf(block_size);
+	for(;;){
+		unsigned long long raw_size=0, bit_count=0;
+		HuffmanCodeLengths lengths;
+		if(read_block_header(in,block_size,raw_size,lengths,bit_count)==false){
+			return false;
+		}
+		if(raw_size==0){//结束了
+			break;
+		}
+		size_t payload_size=(bit_count+7)/8;
+		payload.resize(payload_size);
+		if(!in.read(reinterpret_cast<char*>(&payload[0]),payload_size)){
+			return false;
+		}
+		if(huffman_block_decode(&payload[0],payload_size,bit_count,lengths,decode_table,&outbuf[0],raw_size)==false){
+			return false;
+		}
+		if(out.write(&outbuf[0],raw_size)==false){
+			return false;
+		}
+	}
+	return true;
+}
 
-	in.read(reinterpret_cast<char*>(&bit_count),sizeof(bit_count));//读出此文件后面内容占的比特数
-	if(!in){
+//从文件最后读块索引，in要停在第一块开始的地方，读完以后回到原来的位置，index_offset返回索引开始的位置
+//输入不能移动文件指针（比如管道）、文件最后没有块索引或者索引里的数不合理的时候返回false
+bool read_block_index(istream &in,unsigned long long block_size,BlockIndex &index,unsigned long long &index_offset){
+	long size=0;//第一块开始到文件尾的字节数
+	if(remaining_stream_size(in,size)==false || size<8+BLOCK_INDEX_TRAILER_SIZE){
 		return false;
 	}
-	if(tokens.size()==1){//如果词汇表只有一项，那就简单了，直接把这一项输出weight次到out中就行
-		for(long i=0;i<tokens[0].weight;++i){
-			out.write(reinterpret_cast<const char*>(&(tokens[0].byte)),sizeof(tokens[0].byte));
-			if(!out){
-				return false;
+	streampos data_start=in.tellg();
+	bool r=false;
+	do{
+		unsigned long long count=0;
+		char magic[8];
+		in.seekg(size-BLOCK_INDEX_TRAILER_SIZE,ios::cur);
+		if(read_uint64(in,count)==false || read_uint64(in,index_offset)==false || !in.read(magic,8) || memcmp(magic,BLOCK_INDEX_MAGIC,8)!=0){
+			break;
+		}
+		//索引项要正好填满结束块和最后24个字节之间
+		unsigned long long entries_size=size-BLOCK_INDEX_TRAILER_SIZE;
+		if(index_offset<8 || index_offset>entries_size || (entries_size-index_offset)/BLOCK_INDEX_ENTRY_SIZE!=count
+				|| (entries_size-index_offset)%BLOCK_INDEX_ENTRY_SIZE!=0){
+			break;
+		}
+		in.seekg(data_start+static_cast<streamoff>(index_offset));
+		index.resize(count);
+		unsigned long long next=0;//这一块最早可以开始的位置
+		size_t i=0;
+		for(;i<count;++i){
+			BlockIndexEntry &e=index[i];
+			if(read_uint64(in,e.offset)==false || read_uint64(in,e.bit_count)==false || read_uint64(in,e.raw_size)==false){
+				break;
 			}
+			//第一块从0开始，每块都在前一块后面，块头里的数在解码的时候还要和索引对一遍
+			if((i==0 && e.offset!=0) || e.offset<next || e.raw_size==0 || e.raw_size>block_size
+					|| e.bit_count<e.raw_size || e.bit_count>e.raw_size*MAX_CODE_LENGTH){
+				break;
+			}
+			next=e.offset+(e.bit_count+7)/8+16;
 		}
-		return true;
+		r=(i==count && next<=index_offset-8);
+	}while(false);
+	in.clear();
+	in.seekg(data_start);
+	return r;
+}
+
+//从文件的offset处读size个字节，读不满就返回false
+bool pread_all(int fd,unsigned char *buf,size_t size,unsigned long long offset){
+	while(size>0){
+		ssize_t n=pread(fd,buf,size,offset);
+		if(n<=0){
+			return false;
+		}
+		buf+=n;
+		size-=n;
+		offset+=n;
 	}
+	return true;
+}
 
-	Bitstream::In<long> bin(in);//比特流的输入
-	//解码的过程是，从huffman树的根开始往叶子走，在读到比特0时往左，在读到1的时候往右
-	//走到叶子的时候，就是解压缩的结果
-	long rootpos=ht.size()-1;
-	long huffpos=rootpos;//当前解码的位置
-	while(in && read_count<bit_count){//如果我们还没解码完所有的比特
-		bool bit=false;//读出的比特是0还是1，如果是0，bit就是false，如果是1，bit就是true
-		bin.boolean(bit);//从文件中读出一个比特存到变量bit里
-		if(!in){break;}//文件读完了
-		if(bit){
-			if(ht[huffpos].rchild==-1){
-				return false;//没路可走了，说明解码出错，输入文件可能被损坏了
-			}else{
-				huffpos=ht[huffpos].rchild;//在读到1的时候往右走
-			}
-		}else{
-			if(ht[huffpos].lchild==-1){
-				return false;//没路可走了，说明解码出错，输入文件可能被损坏了
-			}else{
-				huffpos=ht[huffpos].lchild;//在读到比特0时往左走
+//把size个字节写到文件的offset处，offset是-1的时候写到文件当前的位置（管道之类的输出）
+bool pwrite_all(int fd,const unsigned char *buf,size_t size,long long offset){
+	while(size>0){
+		ssize_t n=(offset<0 ? write(fd,buf,size) : pwrite(fd,buf,size,offset));
+		if(n<=0){
+			return false;
+		}
+		buf+=n;
+		size-=n;
+		if(offset>=0){
+			offset+=n;
+		}
+	}
+	return true;
+}
+
+//把in_fd从in_offset开始的size个字节复制到out_fd的开头，两个都要是普通文件
+//先用copy_file_range在内核里复制，不用经过用户态的缓冲区；内核或者文件系统不支持的时候用pread、pwrite
+bool copy_file_bytes(int in_fd,unsigned long long in_offset,int out_fd,unsigned long long size){
+	loff_t off_in=in_offset, off_out=0;
+	while(size>0){
+		ssize_t n=copy_file_range(in_fd,&off_in,out_fd,&off_out,size,0);
+		if(n<0 && errno==EINTR){
+			continue;
+		}
+		if(n<=0){
+			break;
+		}
+		size-=n;
+	}
+	vector<unsigned char> buf(size>0 ? PARALLEL_ENCODE_CHUNK_SIZE : 0);
+	while(size>0){
+		size_t len=min(static_cast<unsigned long long>(buf.size()),size);
+		if(pread_all(in_fd,&buf[0],len,off_in)==false || pwrite_all(out_fd,&buf[0],len,off_out)==false){
+			return false;
+		}
+		off_in+=len;
+		off_out+=len;
+		size-=len;
+	}
+	return true;
+}
+
+//解压缩存储的第2版格式文件（编码长度都是8，见stored_code_lengths），in停在比特数前面
+//压缩内容就是原来的字节，不用解码：输入输出都是普通文件的时候用copy_file_bytes复制，否则一段一段地从in读出来写到输出
+bool huffman_stored_unzip(istream &in,const char *in_filename,const char *out_filename)
+{
+	unsigned long long bit_count=0;
+	long size=0;
+	if(read_uint64(in,bit_count)==false || bit_count%8!=0
+			|| (remaining_stream_size(in,size) && static_cast<unsigned long long>(size)<bit_count/8)){//文件比记录的比特数短，已经损坏了
+		clog<<"输入文件已损坏："<<in_filename<<endl;
+		return false;
+	}
+	bool r=false;
+	if(is_regular_file(in_filename) && can_map_output(out_filename)){
+		int in_fd=open(in_filename,O_RDONLY);
+		int out_fd=open(out_filename,O_WRONLY|O_CREAT|O_TRUNC,0666);
+		r=(in_fd>=0 && out_fd>=0 && copy_file_bytes(in_fd,in.tellg(),out_fd,bit_count/8));
+		if(in_fd>=0){
+			close(in_fd);
+		}
+		if(out_fd>=0 && close(out_fd)!=0){
+			r=false;
+		}
+	}else{
+		ofstream out;
+		FdSink stdout_sink(STDOUT_FILENO);
+		StreamSink stream_sink(out);
+		bool to_stdout=(stdio_fd(out_filename)==STDOUT_FILENO);
+		if(to_stdout==false){
+			out.open(out_filename,ios_base::out|ios_base::binary);
+		}
+		ByteSink &sink=(to_stdout ? static_cast<ByteSink&>(stdout_sink) : stream_sink);
+		vector<char> buf(PARALLEL_ENCODE_CHUNK_SIZE);
+		unsigned long long remain=bit_count/8;
+		while(remain>0 && (to_stdout || out)){
+			size_t len=min(static_cast<unsigned long long>(buf.size()),remain);
+			if(!in.read(&buf[0],len) || sink.write(reinterpret_cast<const unsigned char*>(&buf[0]),len)==false){
+				break;
 			}
+			remain-=len;
 		}
-		//看看是不是已经走到叶子了
-		if(ht[huffpos].lchild==-1 && ht[huffpos].rchild==-1){//叶子节点的lchild和rchild肯定都是-1
-			//把叶子节点对应的单词输出到out
-			out.write(reinterpret_cast<const char*>(&(tokens[huffpos].byte)),sizeof(tokens[huffpos].byte));
-			if(!out){
-				return false;
+		if(to_stdout==false){
+			out.close();
+		}
+		r=(remain==0 && !out.fail());
+	}
+	if(r==false){
+		clog<<"输入文件已损坏或写输出文件失败："<<endl<<"\t"<<in_filename<<endl<<"\t"<<out_filename<<endl;
+	}
+	return r;
+}
+
+//多线程解压缩时的一个块
+struct BlockDecodeJob{
+	const BlockIndexEntry *entry;//这块的索引项
+	unsigned long long size;//这块在压缩文件里的字节数，包括块头
+	unsigned long long out_offset;//这块解压缩以后在输出文件里的位置
+	vector<unsigned char> input;//读进来的这块
+	vector<unsigned char> output;//解压缩的结果
+	bool ok;//解压缩（和写输出文件）是否成功
+};
+
+//一批要多线程解压缩的块
+struct BlockDecodeBatch{
+	vector<BlockDecodeJob> jobs;
+	int in_fd;
+	int out_fd;
+	bool direct;//每个线程自己把结果写到输出文件里它的位置上
+	unsigned long long data_start;//第一块在压缩文件里的位置
+	unsigned long long block_size;
+	int decode_table;
+};
+
+//线程池里的任务：读第index块，检查块头和索引一致以后解码，能直接写输出文件的时候写到它的位置上
+void block_decode_task(void *arg,long index){
+	BlockDecodeBatch *batch=static_cast<BlockDecodeBatch*>(arg);
+	BlockDecodeJob &job=batch->jobs[index];
+	job.ok=false;
+	job.input.resize(job.size);
+	if(pread_all(batch->in_fd,&job.input[0],job.size,batch->data_start+job.entry->offset)==false){
+		return;
+	}
+	MemoryInBuf buf(&job.input[0],job.size);
+	istream is(&buf);
+	unsigned long long raw_size=0, bit_count=0;
+	HuffmanCodeLengths lengths;
+	if(read_block_header(is,batch->block_size,raw_size,lengths,bit_count)==false
+			|| raw_size!=job.entry->raw_size || bit_count!=job.entry->bit_count || buf.consumed()+(bit_count+7)/8!=job.size){
+		return;
+	}
+	job.output.resize(raw_size);
+	if(huffman_block_decode(&job.input[0]+buf.consumed(),(bit_count+7)/8,bit_count,lengths,batch->decode_table,&job.output[0],raw_size)==false){
+		return;
+	}
+	if(batch->direct && pwrite_all(batch->out_fd,&job.output[0],raw_size,job.out_offset)==false){
+		return;
+	}
+	job.ok=true;
+}
+
+//按块索引多线程解压缩第4版格式，data_start是压缩文件里第一块的位置
+//每块解压缩以后在输出文件里的位置是前面所有块的字节数之和，事先就知道，输出是普通文件的时候每个线程直接用pwrite写到自己的位置上
+//输出是管道之类的时候，每批解完由调用线程按顺序写出去
+//每次处理线程数两倍的块，内存里最多只有这么多块
+bool huffman_block_unzip_indexed(const char *in_filename,const char *out_filename,unsigned long long data_start,
+		unsigned long long block_size,const BlockIndex &index,unsigned long long index_offset,const HuffmanOptions &opt)
+{
+	int in_fd=open(in_filename,O_RDONLY);
+	if(in_fd<0){
+		clog<<"无法打开输入文件："<<in_filename<<endl;
+		return false;
+	}
+	int out_fd=open(out_filename,O_WRONLY|O_CREAT|O_TRUNC,0666);
+	if(out_fd<0){
+		close(in_fd);
+		clog<<"无法打开输出文件："<<out_filename<<endl;
+		return false;
+	}
+	struct stat st;
+	ThreadPool pool(opt.threads);
+	size_t wave_blocks=pool.size()*2;//一次处理的块数
+	BlockDecodeBatch batch;
+	batch.in_fd=in_fd;
+	batch.out_fd=out_fd;
+	batch.direct=(fstat(out_fd,&st)==0 && S_ISREG(st.st_mode));
+	batch.data_start=data_start;
+	batch.block_size=block_size;
+	batch.decode_table=opt.decode_table;
+
+	bool r=true;
+	unsigned long long out_offset=0;
+	for(size_t first=0;first<index.size() && r;first+=wave_blocks){
+		batch.jobs.assign(min(wave_blocks,index.size()-first),BlockDecodeJob());
+		for(size_t i=0;i<batch.jobs.size();++i){
+			size_t k=first+i;
+			BlockDecodeJob &job=batch.jobs[i];
+			job.entry=&index[k];
+			job.size=(k+1<index.size() ? index[k+1].offset : index_offset-8)-index[k].offset;//最后一块后面是8字节的结束块
+			job.out_offset=out_offset;
+			out_offset+=index[k].raw_size;
+		}
+		pool.run(block_decode_task,&batch,batch.jobs.size());
+		for(size_t i=0;i<batch.jobs.size() && r;++i){
+			r=batch.jobs[i].ok;
+			if(r && batch.direct==false){
+				r=pwrite_all(out_fd,&batch.jobs[i].output[0],batch.jobs[i].output.size(),-1);
 			}
-			huffpos=rootpos;//把当前位置移动到根节点，开始下一轮解码
 		}
-		++read_count;//积累我们已经处理过的比特数
 	}
-	return true;
+	close(in_fd);
+	if(close(out_fd)!=0){
+		r=false;
+	}
+	if(r==false){
+		clog<<"输入文件已损坏或写输出文件失败："<<endl<<"\t"<<in_filename<<endl<<"\t"<<out_filename<<endl;
+	}
+	return r;
 }
 
 //使用huffman树的原理进行解压缩的函数
-bool huffman_unzip(const char *in_filename,const char *out_filename)
+bool huffman_unzip(const char *in_filename,const char *out_filename,const HuffmanOptions &opt)
 {
 	HuffmanTree ht;//huffman树
 	TokenList tokens;//词汇表
@@ -498,21 +3026,85 @@ bool huffman_unzip(const char *in_filename,const char *out_filename)
 		clog<<"无法打开输入文件："<<in_filename<<endl;
 		return false;
 	}
-	header=read_huffman_zip_header(in);//读压缩文件头
-	if(header!=MAGIC_VERSION){//判断是否是我们压缩过的文件
+	//普通文件映射到内存里，压缩内容直接从映射里解码，不用再复制一遍
+	MappedFile input;
+	bool mapped=(opt.mmap && opt.io_uring==false && input.map(in_filename));
+	MemoryInBuf mapped_buf(input.data(),input.size());
+	istream mapped_in(&mapped_buf);
+	istream &src=(mapped ? mapped_in : in);
+	header=read_huffman_zip_header(src);//读压缩文件头
+	int format=0;//压缩文件格式的版本
+	HuffmanCodeLengths lengths;//第2版和第3版格式的编码长度
+	unsigned long long block_size=0;//第4版格式的块大小
+	if(header==MAGIC_VERSION){//判断是否是我们压缩过的文件
+		format=1;
+		r=read_huffman_tree(src,ht,tokens);//从文件中读出huffman树和词汇表，重建起这两个数据结构
+	}else if(header==MAGIC_VERSION_2){
+		format=2;
+		r=read_huffman_code_lengths(src,lengths) && create_canonical_tree(lengths,ht,tokens);//从编码长度重建huffman树和词汇表
+	}else if(header==MAGIC_VERSION_3){
+		format=3;
+		r=read_huffman_code_lengths(src,lengths);//第3版格式直接从编码长度建解码表，不用huffman树
+	}else if(header==MAGIC_VERSION_4){
+		format=4;
+		r=read_block_size(src,block_size);//第4版格式每块有自己的编码长度，解码的时候一块一块读
+	}else{
 		clog<<"无法读取输入文件，或着它不是hzip格式的压缩文件："<<in_filename<<endl;
 		return false;
 	}
-	if(read_huffman_tree(in,ht,tokens)==false){//从文件中读出huffman树和词汇表，重建起这两个数据结构
+	if(r==false){
 		clog<<"无法从输入文件中读取元信息："<<in_filename<<endl;
+		return false;
+	}
+	BlockIndex index;
+	unsigned long long index_offset=0;
+	if(format==4 && opt.threads>1 && read_block_index(src,block_size,index,index_offset)){//有块索引，多线程解压缩
+		unsigned long long data_start=src.tellg();
+		in.close();
+		return huffman_block_unzip_indexed(in_filename,out_filename,data_start,block_size,index,index_offset,opt);
 	}
 
-	out.open(out_filename,ios_base::out|ios_base::binary);//必须用binary模式打开，否则系统会作多余的转换
-	if(!out){
+	if(format==2 && stored_code_lengths(lengths)){//存储的文件直接复制
+		return huffman_stored_unzip(src,in_filename,out_filename);
+	}
+	//用io_uring的时候，第1、2版格式的压缩内容从比特数后面开始用UringSource读，输出是普通文件的时候用UringSink写
+	UringSource uring_in;
+	UringSink uring_out;
+	bool uring=(opt.io_uring && (format==1 || format==2));
+	bool uring_input=false, uring_output=false;
+	if(uring){
+		unsigned long long payload_start=static_cast<unsigned long long>(src.tellg())+(format==1 ? sizeof(long) : 8);
+		uring_input=uring_in.open(in_filename,payload_start);
+		uring_output=(can_map_output(out_filename) && uring_out.open(out_filename,0));
+		if(opt.verbose){
+			clog<<(uring_in.uring() || uring_out.uring() ? "读写文件用io_uring" : "io_uring不可用，读写文件用pread、pwrite")<<endl;
+		}
+	}
+	bool to_stdout=(stdio_fd(out_filename)==STDOUT_FILENO && format!=3);//第3版格式还是写文件流
+	if(uring_output==false && to_stdout==false){
+		out.open(out_filename,ios_base::out|ios_base::binary);//必须用binary模式打开，否则系统会作多余的转换
+	}
+	if(uring_output==false && to_stdout==false && !out){
 		clog<<"无法打开输出文件："<<out_filename<<endl;
 		return false;
 	}
-	r=huffman_data_decode(in,out,ht,tokens);//对输入文件解码
+	FdSink stdout_sink(STDOUT_FILENO);//写到标准输出的时候直接用write，不经过文件流
+	StreamSink stream_sink(out);
+	ByteSink &sink=(uring_output ? static_cast<ByteSink&>(uring_out) : (to_stdout ? static_cast<ByteSink&>(stdout_sink) : stream_sink));
+	if(format==3){
+		r=huffman_interleaved_decode(src,out,lengths,opt.decode_table);//几个子流交错地解码
+	}else if(format==4){
+		r=huffman_block_unzip(src,sink,block_size,opt.decode_table);//一块一块地解码
+	}else{
+		PipelineStats stats={0,0,0,0};
+		r=huffman_data_decode(src,sink,ht,tokens,format,opt.decode_table,opt.threads,opt.pipeline ? &stats : 0,uring_input ? &uring_in : 0);//对输入文件解码
+		if(uring_output){
+			r=(uring_out.finish() && r);//出错的时候也要等写请求都完成
+		}
+		if(r && opt.pipeline && opt.verbose){
+			print_pipeline_stats("解码",stats);
+		}
+	}
 	if(r==false){
 		clog<<"输入文件已损坏或写输出文件失败："<<endl<<"\t"<<in_filename<<endl<<"\t"<<out_filename<<endl;
 		return false;
@@ -522,14 +3114,240 @@ bool huffman_unzip(const char *in_filename,const char *out_filename)
 	return r;
 }
 
+//用默认值初始化命令行选项
+void init_huffman_options(HuffmanOptions &opt){
+	opt.decompress=false;
+	opt.verbose=false;
+	opt.encode_table=ENCODE_TABLE_AUTO;
+	opt.decode_table=DECODE_TABLE_AUTO;
+	opt.format=1;
+	opt.format_given=false;
+	opt.streams=4;
+	opt.block_size=DEFAULT_BLOCK_SIZE;
+	opt.threads=1;
+	opt.max_code_length=0;
+	opt.fast=false;
+	opt.mmap=true;
+	opt.pipeline=false;
+	opt.io_uring=false;
+}
+
+//打印命令行用法
+void print_usage(const char *prog){
+	clog<<"用法："<<endl;
+	clog<<"  "<<prog<<"\t\t\t\t交互方式，输入文件名后压缩，再解压缩出来检验"<<endl;
+	clog<<"  "<<prog<<" [选项] 输入文件 [输出文件]\t压缩，默认输出到 输入文件.hzip"<<endl;
+	clog<<"  "<<prog<<" -d [选项] 输入文件 [输出文件]\t解压缩，默认输出到 输入文件.unhzip"<<endl;
+	clog<<"  文件名是-的时候表示标准输入或标准输出，输入是-的时候默认输出到标准输出；输入或输出是管道的时候自动改用第4版格式流式压缩"<<endl;
+	clog<<"选项："<<endl;
+	clog<<"  -d\t\t\t\t解压缩"<<endl;
+	clog<<"  -v\t\t\t\t输出耗时和速度"<<endl;
+	clog<<"  --encode-table=auto|single|pair|simd\t编码表的种类，pair一次查表编码两个单词，simd用AVX2一次编码8个单词，默认auto根据CPU、编码长度和文件大小自动选择"<<endl;
+	clog<<"  --decode-table=auto|single|multi\t解码表的种类，默认auto根据编码长度自动选择；第3版格式用single时不用AVX2"<<endl;
+	clog<<"  --format=1|2|3|4\t\t压缩文件格式的版本，默认是1，存整棵huffman树，只认第1版的旧程序也能解压；2只存编码长度，文件头小得多；3把单词交错地放到几个子流里，解码更快，编码长度限制在"<<INTERLEAVED_MAX_CODE_LENGTH<<"比特以内；4把输入切成块，每块单独建huffman树和编码"<<endl;
+	clog<<"  --streams=4|8\t\t\t第3版格式的子流数，默认是4，8个子流的时候解压缩可以用AVX2"<<endl;
+	clog<<"  --block-size=N\t\t第4版格式的块大小，可以带K、M后缀，默认是1M"<<endl;
+	clog<<"  --threads=N\t\t\t压缩和解压缩用的线程数，默认是1，0表示用所有的CPU；第1、2版格式解压缩时推测地从中间开始解码，第4版格式解压缩时要用文件最后的块索引"<<endl;
+	clog<<"  --max-code-length=N\t\t用package-merge算法把编码长度限制在N比特以内（1到"<<MAX_CODE_LENGTH<<"）"<<endl;
+	clog<<"  --fast\t\t\t只用采样的"<<FAST_SAMPLE_SIZE/1048576<<"M数据估计词汇表，输入只读一遍，可以是管道；压缩率会差一点，加-v输出差了多少；第4版格式本来就只读一遍"<<endl;
+	clog<<"  --no-mmap\t\t\t不把输入输出文件映射到内存里，都用文件流读写；管道和特殊文件本来就用文件流"<<endl;
+	clog<<"  --pipeline\t\t\t第1、2版格式读输入和写输出各用一个线程，和编码、解码同时进行，加-v输出每个阶段等了多久；输入映射到内存里的时候不用读线程"<<endl;
+	clog<<"  --io-uring\t\t\t普通文件不映射到内存里，用io_uring一次提交几个读请求、异步提交写请求；编译时没加IO_URING=1或者内核不支持的时候用pread、pwrite"<<endl;
+}
+
+//解析带K、M后缀的大小，比如256K、4M
+bool parse_size(const char *s,long &size){
+	char *end=0;
+	long value=strtol(s,&end,10);
+	if(end==s || value<=0){
+		return false;
+	}
+	if(*end=='K' || *end=='k'){
+		value<<=10;
+		++end;
+	}else if(*end=='M' || *end=='m'){
+		value<<=20;
+		++end;
+	}
+	if(*end!='\0'){
+		return false;
+	}
+	size=value;
+	return true;
+}
+
+//解析命令行选项，非选项参数（文件名）按顺序放到files里
+bool parse_huffman_options(int argc,char* argv[],HuffmanOptions &opt,vector<string> &files){
+	for(int i=1;i<argc;++i){
+		string arg=argv[i];
+		if(arg=="-d"){
+			opt.decompress=true;
+		}else if(arg=="-v"){
+			opt.verbose=true;
+		}else if(arg=="--fast"){
+			opt.fast=true;
+		}else if(arg=="--no-mmap"){
+			opt.mmap=false;
+		}else if(arg=="--pipeline"){
+			opt.pipeline=true;
+		}else if(arg=="--io-uring"){
+			opt.io_uring=true;
+		}else if(arg.compare(0,15,"--encode-table=")==0){
+			string kind=arg.substr(15);
+			if(kind=="auto"){
+				opt.encode_table=ENCODE_TABLE_AUTO;
+			}else if(kind=="single"){
+				opt.encode_table=ENCODE_TABLE_SINGLE;
+			}else if(kind=="pair"){
+				opt.encode_table=ENCODE_TABLE_PAIR;
+			}else if(kind=="simd"){
+				opt.encode_table=ENCODE_TABLE_SIMD;
+			}else{
+				clog<<"未知的编码表种类："<<kind<<endl;
+				return false;
+			}
+		}else if(arg.compare(0,15,"--decode-table=")==0){
+			string kind=arg.substr(15);
+			if(kind=="auto"){
+				opt.decode_table=DECODE_TABLE_AUTO;
+			}else if(kind=="single"){
+				opt.decode_table=DECODE_TABLE_SINGLE;
+			}else if(kind=="multi"){
+				opt.decode_table=DECODE_TABLE_MULTI;
+			}else{
+				clog<<"未知的解码表种类："<<kind<<endl;
+				return false;
+			}
+		}else if(arg=="--format=1"){
+			opt.format=1;
+			opt.format_given=true;
+		}else if(arg=="--format=2"){
+			opt.format=2;
+			opt.format_given=true;
+		}else if(arg=="--format=3"){
+			opt.format=3;
+			opt.format_given=true;
+		}else if(arg=="--format=4"){
+			opt.format=4;
+			opt.format_given=true;
+		}else if(arg.compare(0,13,"--block-size=")==0){
+			if(parse_size(arg.c_str()+13,opt.block_size)==false || opt.block_size<MIN_BLOCK_SIZE || opt.block_size>MAX_BLOCK_SIZE){
+				clog<<"块大小必须在"<<MIN_BLOCK_SIZE/1024<<"K到"<<MAX_BLOCK_SIZE/1024/1024<<"M之间："<<arg<<endl;
+				return false;
+			}
+		}else if(arg.compare(0,10,"--threads=")==0){
+			opt.threads=atoi(arg.c_str()+10);
+			if(opt.threads==0){//0表示用机器上所有的CPU
+				opt.threads=ThreadPool::cpu_count();
+			}
+			if(opt.threads<1 || opt.threads>1024){
+				clog<<"线程数必须在0到1024之间："<<arg<<endl;
+				return false;
+			}
+		}else if(arg=="--streams=4"){
+			opt.streams=4;
+		}else if(arg=="--streams=8"){
+			opt.streams=8;
+		}else if(arg.compare(0,18,"--max-code-length=")==0){
+			opt.max_code_length=atoi(arg.c_str()+18);
+			if(opt.max_code_length<1 || opt.max_code_length>MAX_CODE_LENGTH){
+				clog<<"编码长度限制必须在1到"<<MAX_CODE_LENGTH<<"之间："<<arg<<endl;
+				return false;
+			}
+		}else if(arg.size()>1 && arg[0]=='-'){
+			clog<<"未知的选项："<<arg<<endl;
+			return false;
+		}else{
+			files.push_back(arg);
+		}
+	}
+	if(files.size()<1 || files.size()>2){
+		return false;
+	}
+	return true;
+}
+
+//取文件大小，用来计算速度，取不到就返回-1
+long file_size(const char *filename){
+	ifstream f(filename,ios_base::in|ios_base::binary);
+	if(!f){
+		return -1;
+	}
+	f.seekg(0,ios::end);
+	return f.tellg();
+}
+
+//输出耗时和速度，速度按未压缩的大小计算
+void print_stats(const char *what,const char *in_filename,const char *out_filename,double seconds,bool decompress){
+	long in_size=file_size(in_filename), out_size=file_size(out_filename);
+	long raw_size=decompress ? out_size : in_size;
+	clog<<what<<"："<<in_size<<" -> "<<out_size<<" 字节，耗时 "<<seconds<<" 秒";
+	if(seconds>0){
+		clog<<"，"<<raw_size/seconds/1e6<<" MB/s";
+	}
+	clog<<endl;
+}
+
+//命令行上的文件名-表示标准输入或标准输出
+string command_line_filename(const string &name,bool output){
+	if(name!="-"){
+		return name;
+	}
+	return output ? STDOUT_FILENAME : STDIN_FILENAME;
+}
+
+//命令行方式：只压缩或者只解压缩一个文件
+int run_command_line(int argc, char* argv[])
+{
+	HuffmanOptions opt;
+	vector<string> files;
+	init_huffman_options(opt);
+	if(parse_huffman_options(argc,argv,opt,files)==false){
+		print_usage(argv[0]);
+		return 2;
+	}
+	string in_filename=files[0], out_filename;
+	if(files.size()==2){
+		out_filename=files[1];
+	}else if(in_filename=="-"){//从标准输入读的时候写到标准输出，可以放在管道中间
+		out_filename="-";
+	}else{
+		out_filename=in_filename+(opt.decompress ? ".unhzip" : ".hzip");
+	}
+	bool piped=(in_filename=="-" || out_filename=="-");
+	in_filename=command_line_filename(in_filename,false);
+	out_filename=command_line_filename(out_filename,true);
+
+	double start=now_seconds();
+	bool r=false;
+	if(opt.decompress){
+		r=huffman_unzip(in_filename.c_str(),out_filename.c_str(),opt);
+	}else{
+		r=huffman_zip(in_filename.c_str(),out_filename.c_str(),opt);
+	}
+	if(r==false){
+		return 1;
+	}
+	if(opt.verbose && piped==false){//管道取不到大小
+		print_stats(opt.decompress ? "解压" : "压缩",in_filename.c_str(),out_filename.c_str(),now_seconds()-start,opt.decompress);
+	}
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
+	if(argc>1){//有命令行参数的时候，按命令行方式运行
+		return run_command_line(argc,argv);
+	}
+
+	HuffmanOptions opt;
+	init_huffman_options(opt);
 	string in_filename,zip_filename,out_filename;
 	cout<<"请输入文件名或完整路径（回车表示输入完毕，不支持中文）："<<endl;
 	getline(cin,in_filename);
 	zip_filename=in_filename+".hzip";
 	cout<<"正在压缩……"<<endl;
-	if(huffman_zip(in_filename.c_str(),zip_filename.c_str())){
+	if(huffman_zip(in_filename.c_str(),zip_filename.c_str(),opt)){
 		cout<<"压缩已完成，输出文件："<<zip_filename<<endl;
 	}else{
 		cout<<"压缩失败，请查看历史记录以确定错误信息。"<<endl;
@@ -538,7 +3356,7 @@ int main(int argc, char* argv[])
 	}
 	out_filename=in_filename+".unhzip";
 	cout<<"正在解压……"<<endl;
-	if(huffman_unzip(zip_filename.c_str(),out_filename.c_str())){
+	if(huffman_unzip(zip_filename.c_str(),out_filename.c_str(),opt)){
 		cout<<"解压已完成，输出文件："<<out_filename<<endl;
 	}else{
 		cout<<"解压失败，请查看历史记录以确定错误信息。"<<endl;
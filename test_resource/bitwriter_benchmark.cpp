@@ -0,0 +1,93 @@
+//比较Costella::Bitstream::Out和BitWriter写huffman编码的速度，并检查两者写出来的内容是否一样
+//用法：./bitwriter_benchmark [编码个数]
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <limits>
+#include <time.h>
+#include "../Bitstream.imp.h"
+#include "../BitWriter.h"
+
+using namespace std;
+using namespace Costella;
+
+//取当前时间，单位是秒
+double now_seconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+int main(int argc, char* argv[])
+{
+	long count=(argc>1 ? atol(argv[1]) : 16*1024*1024);
+
+	//随机生成一批编码，长度在1到16比特之间，和一般文件的huffman编码差不多
+	vector<uint64_t> codes(count);
+	vector<int> lens(count);
+	srand(1);
+	for(long i=0;i<count;++i){
+		lens[i]=rand()%16+1;
+		codes[i]=static_cast<uint64_t>(rand())&((1ULL<<lens[i])-1);
+	}
+
+	//Costella::Bitstream::Out，和原来的huffman_data_encode一样一个比特一个比特地写
+	ostringstream oss_bits;
+	double start=now_seconds();
+	{
+		Bitstream::Out<long> bout(oss_bits);
+		for(long i=0;i<count;++i){
+			for(int bit=lens[i]-1;bit>=0;--bit){
+				bout.boolean(((codes[i]>>bit)&1)!=0);
+			}
+		}
+		bout.flush();
+	}
+	double seconds_bits=now_seconds()-start;
+
+	//Costella::Bitstream::Out，用fixed一次写一个编码
+	ostringstream oss_fixed;
+	start=now_seconds();
+	{
+		Bitstream::Out<long> bout(oss_fixed);
+		for(long i=0;i<count;++i){
+			bout.fixed(codes[i],lens[i]);
+		}
+		bout.flush();
+	}
+	double seconds_fixed=now_seconds()-start;
+
+	//BitWriter，缓冲区快满的时候写到ostringstream里
+	ostringstream oss_writer;
+	vector<unsigned char> buf(65536+8);
+	start=now_seconds();
+	{
+		BitWriter bw(&buf[0],&buf[0]+buf.size());
+		for(long i=0;i<count;++i){
+			bw.put(codes[i],lens[i]);
+			if(bw.room()<8){
+				oss_writer.write(reinterpret_cast<const char*>(bw.data()),bw.size());
+				bw.clear();
+			}
+		}
+		bw.flush();
+		oss_writer.write(reinterpret_cast<const char*>(bw.data()),bw.size());
+	}
+	double seconds_writer=now_seconds()-start;
+
+	double mb=count/1e6;//每个编码对应原来文件的一个字节
+	cout<<"编码个数："<<count<<endl;
+	cout<<"Bitstream::Out::boolean\t"<<seconds_bits<<" 秒\t"<<mb/seconds_bits<<" MB/s"<<endl;
+	cout<<"Bitstream::Out::fixed\t"<<seconds_fixed<<" 秒\t"<<mb/seconds_fixed<<" MB/s"<<endl;
+	cout<<"BitWriter::put\t\t"<<seconds_writer<<" 秒\t"<<mb/seconds_writer<<" MB/s"<<endl;
+	if(oss_bits.str()==oss_fixed.str() && oss_bits.str()==oss_writer.str()){
+		cout<<"test ok"<<endl;
+		return 0;
+	}else{
+		cout<<"test failed"<<endl;
+		return 1;
+	}
+}
@@ -0,0 +1,32 @@
+#!/bin/bash
+# 比较单单词解码表和多单词解码表的解压速度
+# 用法：./decode_benchmark.sh 次数 [程序名]
+
+run_unzip(){
+	COUNTER=$1
+	CMD=$2
+	FILE=$3
+	TABLE=$4
+	while [ $COUNTER -gt 0 ]; do
+		../$CMD -d --decode-table=$TABLE $FILE.hzip $FILE.unhzip >/dev/null 2>&1
+	COUNTER=$(($COUNTER-1))
+	done
+	return 0
+}
+
+COUNT=${1:-100}
+CMD=${2:-huffman_zip}
+for FILE in tags red.txt; do
+	../$CMD $FILE $FILE.hzip
+	for TABLE in single multi auto; do
+		echo "begin to unzip "$FILE" with "$TABLE" decode table "$COUNT" times..."
+		time run_unzip $COUNT $CMD $FILE $TABLE
+		diff $FILE $FILE.unhzip >/dev/null
+		if [ $? -eq 0 ]; then
+			echo "test ok"
+		else
+			echo "test failed"
+		fi
+		echo ""
+	done
+done
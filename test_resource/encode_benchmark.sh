@@ -0,0 +1,33 @@
+#!/bin/bash
+# 比较单单词编码表和双单词编码表的压缩速度，并检查两种编码表压缩出来的文件完全一样
+# 用法：./encode_benchmark.sh 次数 [程序名]
+
+run_zip(){
+	COUNTER=$1
+	CMD=$2
+	FILE=$3
+	TABLE=$4
+	while [ $COUNTER -gt 0 ]; do
+		../$CMD -v --encode-table=$TABLE $FILE $FILE.$TABLE.hzip
+	COUNTER=$(($COUNTER-1))
+	done
+	return 0
+}
+
+COUNT=${1:-10}
+CMD=${2:-huffman_zip}
+for FILE in tags red.txt; do
+	for TABLE in single pair; do
+		echo "begin to zip "$FILE" with "$TABLE" encode table "$COUNT" times..."
+		# -v把速度输出到标准错误，这里只留下MB/s的数值，取平均
+		run_zip $COUNT $CMD $FILE $TABLE 2>&1 | sed -n 's/.*，\([0-9.e+-]*\) MB\/s/\1/p' | awk '{sum+=$1} END {if(NR>0) printf "average %.2f MB/s\n", sum/NR}'
+	done
+	cmp $FILE.single.hzip $FILE.pair.hzip >/dev/null
+	if [ $? -eq 0 ]; then
+		echo "test ok"
+	else
+		echo "test failed"
+	fi
+	rm -f $FILE.single.hzip $FILE.pair.hzip
+	echo ""
+done
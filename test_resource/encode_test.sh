@@ -0,0 +1,38 @@
+#!/bin/bash
+# 检查每种编码表压缩出来的文件和一个一个单词编码的完全一样，并且能正确解压
+# 用法：./encode_test.sh [程序名]
+# 除了test_resource下的文件，还用随机数据测试：均匀随机的字节（编码都是8比特），
+# 只有几十个单词的随机文本（编码不超过16比特，AVX2四个一组），以及长度不是8的倍数的文件（剩下几个单词一个一个编码）
+# 多线程编码的结果也要和一个线程编码的完全一样，随机字节比多线程编码的一段长，检查段和段之间的比特拼接
+# random_long.txt是red.txt接上随机字节，有好几个8M的段，每段编码的比特数不是8的倍数，检查多线程直接编码到输出文件里时段和段共用的字节
+# 默认直接编码到映射的输出文件里，--no-mmap用文件流读写，两种方法的结果也要完全一样，--pipeline用读写线程的流水线、--io-uring用io_uring读写也一样
+
+CMD=${1:-huffman_zip}
+RESULT=0
+
+head -c 2500003 /dev/urandom >random_bytes.bin
+head -c 3000000 /dev/urandom | base64 | head -c 1000005 >random_text.txt
+head -c 7 /dev/urandom >random_tiny.bin
+(for i in 1 2 3 4 5 6 7 8 9; do cat red.txt; head -c 100003 /dev/urandom; done) >random_long.txt
+
+for FILE in red.txt tags worst_single.txt worst_two.txt worst_uniform256.bin worst_fibonacci.txt random_bytes.bin random_text.txt random_tiny.bin random_long.txt; do
+	for FORMAT in 1 2; do
+		../$CMD --format=$FORMAT --encode-table=single $FILE $FILE.single.hzip
+		for TABLE in pair simd auto "single --threads=3" "simd --threads=2" "single --no-mmap" "pair --threads=3 --no-mmap" "simd --pipeline --no-mmap" "pair --threads=3 --io-uring"; do
+			rm -f $FILE.hzip $FILE.unhzip
+			../$CMD --format=$FORMAT --encode-table=$TABLE $FILE $FILE.hzip && ../$CMD -d $FILE.hzip $FILE.unhzip
+			cmp $FILE.single.hzip $FILE.hzip >/dev/null && diff $FILE $FILE.unhzip >/dev/null
+			if [ $? -eq 0 ]; then
+				echo "test ok: $FILE --format=$FORMAT --encode-table=$TABLE"
+			else
+				echo "test failed: $FILE --format=$FORMAT --encode-table=$TABLE"
+				RESULT=1
+			fi
+		done
+	done
+done
+rm -f random_* *.single.hzip
+for FILE in red.txt tags worst_single.txt worst_two.txt worst_uniform256.bin worst_fibonacci.txt; do
+	rm -f $FILE.hzip $FILE.unhzip
+done
+exit $RESULT
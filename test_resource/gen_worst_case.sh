@@ -0,0 +1,36 @@
+#!/bin/bash
+# 生成huffman编码的几种极端情况，作为测试用的文件
+# 用法：./gen_worst_case.sh [斐波那契文件的单词数]
+# 单词数是34的时候文件大约24MB，最长的编码超过32比特
+
+# 把字符$1重复$2次输出
+repeat_char(){
+	head -c $2 /dev/zero | tr '\0' "$1"
+}
+
+# 只有一个单词
+repeat_char 'a' 4096 >worst_single.txt
+
+# 只有两个单词
+repeat_char 'a' 3000 >worst_two.txt
+repeat_char 'b' 1000 >>worst_two.txt
+
+# 256个单词出现的次数都一样，huffman编码起不到压缩作用
+for i in $(seq 16); do
+	for j in $(seq 0 255); do
+		printf "\\$(printf %03o $j)"
+	done
+done >worst_uniform256.bin
+
+# 单词出现的次数是斐波那契数列，huffman树退化成一条链，最长的编码是单词数-1比特
+SYMBOLS=${1:-25}
+CHARS=ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789
+A=1
+B=1
+>worst_fibonacci.txt
+for i in $(seq 0 $(($SYMBOLS-1))); do
+	repeat_char ${CHARS:$i:1} $A >>worst_fibonacci.txt
+	C=$(($A+$B))
+	A=$B
+	B=$C
+done
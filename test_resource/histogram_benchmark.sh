@@ -0,0 +1,35 @@
+#!/bin/bash
+# 比较用1到16个线程统计词汇表的速度，并检查压缩出来的文件都一样
+# 用法：./histogram_benchmark.sh [大小，单位MB] [程序名]
+# 测试文件是red.txt重复到指定的大小，默认1024MB；先读一遍放进页缓存，测的是不受磁盘影响的统计速度
+
+SIZE=${1:-1024}
+CMD=${2:-huffman_zip}
+FILE=red_${SIZE}m.txt
+
+echo "generating "$FILE"..."
+rm -f $FILE
+while [ $(stat -c %s $FILE 2>/dev/null || echo 0) -lt $(($SIZE*1048576)) ]; do
+	cat red.txt red.txt red.txt red.txt red.txt red.txt red.txt red.txt >>$FILE
+done
+truncate -s $(($SIZE*1048576)) $FILE
+cat $FILE >/dev/null
+
+RESULT=0
+for THREADS in 1 2 4 8 16; do
+	# -v输出的第一行是统计词汇表的耗时和速度
+	../$CMD -v --threads=$THREADS $FILE $FILE.$THREADS.hzip 2>&1 | head -1
+	if [ $THREADS -ne 1 ]; then
+		cmp $FILE.1.hzip $FILE.$THREADS.hzip >/dev/null
+		if [ $? -ne 0 ]; then
+			echo "test failed: --threads=$THREADS"
+			RESULT=1
+		fi
+		rm -f $FILE.$THREADS.hzip
+	fi
+done
+if [ $RESULT -eq 0 ]; then
+	echo "test ok"
+fi
+rm -f $FILE $FILE.1.hzip
+exit $RESULT
@@ -0,0 +1,85 @@
+//比较一个字节一个字节地数和Histogram.h里几个版本统计字节出现次数的速度，并检查统计的结果是否一样
+//用法：./histogram_kernel_benchmark [字节数]
+//测试数据有三种：均匀随机的字节，集中在少数几个字节上的偏斜数据（像文本和日志），只有一种字节的数据（存储转发的最坏情况）
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <time.h>
+#include "../Histogram.h"
+
+using namespace std;
+
+//取当前时间，单位是秒
+double now_seconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+//原来的统计方法，每个字节给一张表里的计数加1
+void count_bytes_simple(const unsigned char *data,size_t n,long counts[256]){
+	for(size_t i=0;i<n;++i){
+		++counts[data[i]];
+	}
+}
+
+//统计一遍，返回耗时，kernel是0的时候用原来的方法
+double run_count(const vector<unsigned char> &data,int kernel,long counts[256]){
+	for(int i=0;i<256;++i){
+		counts[i]=0;
+	}
+	double start=now_seconds();
+	if(kernel==0){
+		count_bytes_simple(&data[0],data.size(),counts);
+	}else{
+		histogram_count(&data[0],data.size(),counts,kernel);
+	}
+	return now_seconds()-start;
+}
+
+int main(int argc, char* argv[])
+{
+	long size=(argc>1 ? atol(argv[1]) : 64*1024*1024);
+	vector<unsigned char> uniform(size), skewed(size), single(size,' ');
+	srand(1);
+	for(long i=0;i<size;++i){
+		uniform[i]=static_cast<unsigned char>(rand());
+		//指数分布，一半左右是同一个字节，再往后每个字节的概率减半
+		double r=(rand()+1.0)/(RAND_MAX+2.0);
+		skewed[i]=static_cast<unsigned char>(' '+static_cast<int>(-log(r)/log(2.0))%64);
+	}
+
+	const char *data_names[]={"uniform","skewed","single"};
+	const vector<unsigned char> *datas[]={&uniform,&skewed,&single};
+	const char *kernel_names[]={"simple","scalar x4","sse2 x4","avx2 x8"};
+	bool ok=true;
+	cout<<"字节数："<<size<<endl;
+	for(int d=0;d<3;++d){
+		long expected[256];
+		run_count(*datas[d],0,expected);
+		for(int k=0;k<=HISTOGRAM_KERNEL_AVX2;++k){
+			if(k!=0 && !histogram_kernel_supported(k)){
+				cout<<data_names[d]<<"\t"<<kernel_names[k]<<"\t这台机器不支持"<<endl;
+				continue;
+			}
+			long counts[256];
+			double seconds=run_count(*datas[d],k,counts);
+			cout<<data_names[d]<<"\t"<<kernel_names[k]<<"\t"<<seconds<<" 秒\t"<<size/seconds/1e6<<" MB/s"<<endl;
+			for(int b=0;b<256;++b){
+				if(counts[b]!=expected[b]){
+					ok=false;
+				}
+			}
+		}
+	}
+	if(ok){
+		cout<<"test ok"<<endl;
+		return 0;
+	}else{
+		cout<<"test failed"<<endl;
+		return 1;
+	}
+}
@@ -0,0 +1,68 @@
+#!/bin/bash
+# 比较几种读写文件的方式压缩和解压缩的速度，并检查压缩出来的文件都一样、解压缩以后和原文件一样
+# 用法：./io_benchmark.sh [大小，单位MB] [程序名]
+# 测试文件是red.txt重复到指定的大小，默认4096MB；每种方式都先把输入读一遍放进页缓存
+# --io-uring要用make IO_URING=1编译的程序才真的用io_uring，否则测的是pread、pwrite，-v会输出用的是哪一种
+
+SIZE=${1:-4096}
+CMD=${2:-huffman_zip}
+FILE=red_${SIZE}m.txt
+MODES=("--no-mmap" "--no-mmap --pipeline" "--io-uring" "")
+NAMES=("iostream" "iostream+pipeline" "io_uring" "mmap")
+
+echo "generating "$FILE"..."
+rm -f $FILE
+while [ $(stat -c %s $FILE 2>/dev/null || echo 0) -lt $(($SIZE*1048576)) ]; do
+	cat red.txt red.txt red.txt red.txt red.txt red.txt red.txt red.txt >>$FILE
+done
+truncate -s $(($SIZE*1048576)) $FILE
+
+# 运行一次，输出耗时和速度：run_timed 说明 命令...
+run_timed(){
+	NAME=$1
+	shift
+	START=$(date +%s.%N)
+	"$@" >/dev/null 2>&1
+	R=$?
+	END=$(date +%s.%N)
+	awk -v name="$NAME" -v s=$START -v e=$END -v size=$SIZE 'BEGIN{printf "%-24s %8.3f 秒 %10.1f MB/s\n",name,e-s,size/(e-s)}'
+	return $R
+}
+
+RESULT=0
+../$CMD -v --io-uring $FILE $FILE.hzip 2>&1 | grep io_uring
+for i in ${!MODES[@]}; do
+	cat $FILE >/dev/null
+	run_timed "zip ${NAMES[$i]}" ../$CMD ${MODES[$i]} $FILE $FILE.$i.hzip
+	if [ $? -ne 0 ]; then
+		echo "test failed: zip ${MODES[$i]}"
+		RESULT=1
+	fi
+	if [ $i -ne 0 ]; then
+		cmp $FILE.0.hzip $FILE.$i.hzip >/dev/null
+		if [ $? -ne 0 ]; then
+			echo "test failed: zip ${MODES[$i]} output differs"
+			RESULT=1
+		fi
+		rm -f $FILE.$i.hzip
+	fi
+done
+for i in ${!MODES[@]}; do
+	cat $FILE.0.hzip >/dev/null
+	run_timed "unzip ${NAMES[$i]}" ../$CMD -d ${MODES[$i]} $FILE.0.hzip $FILE.unhzip
+	if [ $? -ne 0 ]; then
+		echo "test failed: unzip ${MODES[$i]}"
+		RESULT=1
+	fi
+	cmp $FILE $FILE.unhzip >/dev/null
+	if [ $? -ne 0 ]; then
+		echo "test failed: unzip ${MODES[$i]} output differs"
+		RESULT=1
+	fi
+	rm -f $FILE.unhzip
+done
+if [ $RESULT -eq 0 ]; then
+	echo "test ok"
+fi
+rm -f $FILE $FILE.hzip $FILE.0.hzip
+exit $RESULT
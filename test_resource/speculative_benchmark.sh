@@ -0,0 +1,34 @@
+#!/bin/bash
+# 比较第1版格式（没有块索引）一个线程解压缩和推测地多线程解压缩的速度，并检查解压出来的文件一样
+# 用法：./speculative_benchmark.sh [大小，单位MB] [线程数] [程序名]
+# 测试文件是red.txt重复到指定的大小，默认1024MB；线程数默认是机器上的CPU数
+
+SIZE=${1:-1024}
+THREADS=${2:-0}
+CMD=${3:-huffman_zip}
+FILE=red_${SIZE}m.txt
+
+echo "generating "$FILE"..."
+rm -f $FILE
+while [ $(stat -c %s $FILE 2>/dev/null || echo 0) -lt $(($SIZE*1048576)) ]; do
+	cat red.txt red.txt red.txt red.txt red.txt red.txt red.txt red.txt >>$FILE
+done
+truncate -s $(($SIZE*1048576)) $FILE
+../$CMD --format=1 $FILE $FILE.hzip
+
+RESULT=0
+for OPTS in "--threads=1" "--threads=$THREADS"; do
+	echo "begin to unzip "$FILE" with "$OPTS"..."
+	rm -f $FILE.unhzip
+	../$CMD -d -v $OPTS $FILE.hzip $FILE.unhzip
+	cmp $FILE $FILE.unhzip >/dev/null
+	if [ $? -eq 0 ]; then
+		echo "test ok"
+	else
+		echo "test failed"
+		RESULT=1
+	fi
+	echo ""
+done
+rm -f $FILE $FILE.hzip $FILE.unhzip
+exit $RESULT
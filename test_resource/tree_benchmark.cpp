@@ -0,0 +1,167 @@
+//比较三种建huffman树的方法在不同单词数下的速度，并检查建出来的树编码以后的总比特数一样
+//用法：./tree_benchmark [最大单词数的2的指数，默认20] [扫描法的最大单词数，默认65536]
+//三种方法：原来每次合并都扫描一遍所有的根（huffman_zip原来的做法，O(n^2)），优先队列（huffman_zip_heap的做法，O(n log n)），
+//排序以后两个队列合并（HuffmanBuilder.h，排序以后O(n)）；单词数从2到2^20，权重是偏斜的随机数，像文本里的字
+//扫描法太慢，单词数超过第二个参数就不测了
+
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <limits>
+#include <cstdlib>
+#include <cmath>
+#include <time.h>
+#include "../HuffmanBuilder.h"
+
+using namespace std;
+
+struct HuffmanNode{
+	long lchild;
+	long rchild;
+	long parent;
+	long weight;
+};
+
+typedef vector<HuffmanNode> HuffmanTree;
+
+//取当前时间，单位是秒
+double now_seconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+//用权重初始化2*n-1个节点
+void init_tree(HuffmanTree &ht,const vector<long> &weights){
+	HuffmanNode default_node={-1,-1,-1,0};
+	long n=weights.size();
+	ht.assign(2*n-1,default_node);
+	for(long i=0;i<n;++i){
+		ht[i].weight=weights[i];
+	}
+}
+
+//原来的方法：每次合并都扫描一遍所有的根，找权重最小和次小的两个
+void scan_tree(HuffmanTree &ht,long n){
+	for(long i=n;i<2*n-1;++i){
+		long min_weight1=numeric_limits<long>::max(), min_weight2=numeric_limits<long>::max();
+		long min_pos1=-1, min_pos2=-1;
+		for(long k=0;k<i;++k){
+			if(ht[k].parent!=-1){
+				continue;
+			}
+			if(ht[k].weight<=min_weight1){
+				min_weight2=min_weight1;
+				min_pos2=min_pos1;
+				min_weight1=ht[k].weight;
+				min_pos1=k;
+			}else if(ht[k].weight<min_weight2){
+				min_weight2=ht[k].weight;
+				min_pos2=k;
+			}
+		}
+		ht[min_pos1].parent=ht[min_pos2].parent=i;
+		ht[i].lchild=min_pos1;
+		ht[i].rchild=min_pos2;
+		ht[i].weight=ht[min_pos1].weight+ht[min_pos2].weight;
+	}
+}
+
+struct NodeComparer{
+	bool operator()(const HuffmanNode *l,const HuffmanNode *r) const{
+		return l->weight>r->weight;
+	}
+};
+
+//huffman_zip_heap的方法：所有的根放在优先队列里
+void heap_tree(HuffmanTree &ht,long n){
+	priority_queue<HuffmanNode*,vector<HuffmanNode*>,NodeComparer> q;
+	for(long i=0;i<n;++i){
+		q.push(&ht[i]);
+	}
+	for(long i=n;i<2*n-1;++i){
+		long min_pos1=q.top()-&ht[0];
+		q.pop();
+		long min_pos2=q.top()-&ht[0];
+		q.pop();
+		ht[min_pos1].parent=ht[min_pos2].parent=i;
+		ht[i].lchild=min_pos1;
+		ht[i].rchild=min_pos2;
+		ht[i].weight=ht[min_pos1].weight+ht[min_pos2].weight;
+		q.push(&ht[i]);
+	}
+}
+
+//编码以后的总比特数：每个叶子的权重乘深度，中间节点都在孩子后面，从根往下算深度
+long long tree_cost(const HuffmanTree &ht,long n){
+	vector<long> depth(ht.size(),0);
+	long long cost=0;
+	for(long i=ht.size()-1;i>=0;--i){
+		if(ht[i].parent>=0){
+			depth[i]=depth[ht[i].parent]+1;
+		}
+		if(i<n){
+			cost+=static_cast<long long>(ht[i].weight)*depth[i];
+		}
+	}
+	return cost;
+}
+
+//建一次树，返回耗时，method是0、1、2分别是扫描、优先队列、两个队列
+double run_build(const vector<long> &weights,int method,long long &cost){
+	HuffmanTree ht;
+	init_tree(ht,weights);
+	long n=weights.size();
+	double start=now_seconds();
+	if(method==0){
+		scan_tree(ht,n);
+	}else if(method==1){
+		heap_tree(ht,n);
+	}else{
+		two_queue_huffman_tree(ht,n);
+	}
+	double seconds=now_seconds()-start;
+	cost=tree_cost(ht,n);
+	return seconds;
+}
+
+int main(int argc, char* argv[])
+{
+	int max_exp=(argc>1 ? atoi(argv[1]) : 20);
+	long max_scan=(argc>2 ? atol(argv[2]) : 65536);
+	const char *method_names[]={"scan","heap","two-queue"};
+	bool ok=true;
+	srand(1);
+	cout<<"单词数\t"<<method_names[0]<<"\t\t"<<method_names[1]<<"\t\t"<<method_names[2]<<endl;
+	for(int e=1;e<=max_exp;++e){
+		long n=1L<<e;
+		vector<long> weights(n);
+		for(long i=0;i<n;++i){//齐夫分布加上随机的扰动，有很多权重一样的单词
+			weights[i]=1+static_cast<long>(1e6/(i+1))+rand()%16;
+		}
+		cout<<n;
+		long long expected=-1;
+		for(int m=0;m<3;++m){
+			if(m==0 && n>max_scan){
+				cout<<"\t-\t";
+				continue;
+			}
+			long long cost=0;
+			double seconds=run_build(weights,m,cost);
+			cout<<"\t"<<seconds<<" 秒";
+			if(expected<0){
+				expected=cost;
+			}else if(cost!=expected){
+				ok=false;
+			}
+		}
+		cout<<endl;
+	}
+	if(ok){
+		cout<<"test ok"<<endl;
+		return 0;
+	}else{
+		cout<<"test failed"<<endl;
+		return 1;
+	}
+}
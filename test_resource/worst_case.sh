@@ -0,0 +1,43 @@
+#!/bin/bash
+# 用极端情况的文件测试各种格式和编码长度限制下的压缩和解压缩
+# 用法：./worst_case.sh [程序名]，测试文件由gen_worst_case.sh生成
+
+CMD=${1:-huffman_zip}
+RESULT=0
+for FILE in worst_single.txt worst_two.txt worst_uniform256.bin worst_fibonacci.txt tags; do
+	for FORMAT in "1" "2" "2 --fast" "3 --streams=4" "3 --streams=8" "4 --block-size=4K --threads=3"; do
+		for LIMIT in 0 8 11 12 15; do
+			OPTS="--format=$FORMAT"
+			if [ $LIMIT -ne 0 ]; then
+				OPTS="$OPTS --max-code-length=$LIMIT"
+			fi
+			../$CMD $OPTS $FILE $FILE.hzip 2>/dev/null && ../$CMD -d $FILE.hzip $FILE.unhzip
+			diff $FILE $FILE.unhzip >/dev/null
+			RC=$?
+			if [ $RC -eq 0 ] && [ "${FORMAT%% *}" = "4" ]; then
+				# 第4版格式再用块索引多线程解压缩一次
+				rm -f $FILE.unhzip
+				../$CMD -d --threads=3 $FILE.hzip $FILE.unhzip && diff $FILE $FILE.unhzip >/dev/null
+				RC=$?
+			fi
+			if [ $RC -eq 0 ]; then
+				echo "test ok: $FILE $OPTS"
+			else
+				echo "test failed: $FILE $OPTS"
+				RESULT=1
+			fi
+		done
+	done
+	# 输入输出都是管道的时候流式压缩和解压缩
+	for OPTS in "" "--threads=3" "--block-size=4K"; do
+		cat $FILE | ../$CMD $OPTS - | ../$CMD -d $OPTS - | cmp -s - $FILE
+		if [ $? -eq 0 ]; then
+			echo "test ok: $FILE pipe $OPTS"
+		else
+			echo "test failed: $FILE pipe $OPTS"
+			RESULT=1
+		fi
+	done
+done
+rm -f worst_*.hzip worst_*.unhzip
+exit $RESULT